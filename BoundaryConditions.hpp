@@ -0,0 +1,136 @@
+//This file contains the boundary conditions of a model: what happens to flow
+//which reaches each of the four edges of the DEM. The cells which erode are
+//those at least two cells in from the edge. The ring of cells around them,
+//which is otherwise held at sea level, carries the boundary conditions, so the
+//loops over the DEM are the same whatever the boundaries. Each edge is one of
+//    OPEN      The ring is at sea level and flow leaves the DEM through it
+//    NO_FLUX   The ring is a wall, higher than any cell, so no cell drains
+//              into it and flow must leave by another edge
+//    PERIODIC  The east and west edges join, so that cells on one may drain to
+//              cells on the other. Must be set on both.
+//
+//The conditions only change which receivers cells choose. Before receivers are
+//found, Refresh() raises the walls and copies the outermost eroding columns
+//into the opposite sides of the ring, so that the receiver kernels see the
+//heights across the wrap. After, WrapReceivers() points the receivers which
+//lead into those copies at the cells they copy, using the wrapped directions
+//8-15 of the grid layout (see GridLayout.hpp), and Restore() puts the ring back
+//at sea level. All of this is O(perimeter) per step.
+#ifndef _boundary_conditions_hpp_
+#define _boundary_conditions_hpp_
+
+#include <limits>
+#include <string>
+
+class BoundaryConditions {
+ public:
+  enum class Edge { OPEN, NO_FLUX, PERIODIC };
+
+  Edge north = Edge::OPEN;
+  Edge east  = Edge::OPEN;
+  Edge south = Edge::OPEN;
+  Edge west  = Edge::OPEN;
+
+  ///Sets the edges from four letters giving the north, east, south, and west
+  ///edges in turn: O for open, N for no-flux, P for periodic. Returns false, and
+  ///changes nothing, if `spec` is not valid.
+  bool parse(const std::string &spec){
+    if(spec.size()!=4)
+      return false;
+    Edge edges[4];
+    for(int i=0;i<4;i++){
+      switch(spec[i]){
+        case 'O': edges[i] = Edge::OPEN;     break;
+        case 'N': edges[i] = Edge::NO_FLUX;  break;
+        case 'P': edges[i] = Edge::PERIODIC; break;
+        default:  return false;
+      }
+    }
+    //Only east and west can wrap, and only together
+    if(edges[0]==Edge::PERIODIC || edges[2]==Edge::PERIODIC)
+      return false;
+    if((edges[1]==Edge::PERIODIC) != (edges[3]==Edge::PERIODIC))
+      return false;
+    north = edges[0];
+    east  = edges[1];
+    south = edges[2];
+    west  = edges[3];
+    return true;
+  }
+
+  bool periodic() const {
+    return east==Edge::PERIODIC;
+  }
+
+  ///The westernmost and easternmost eroding columns, which wrap to each other
+  static int WrapWest()                { return 2;       }
+  static int WrapEast(const int width) { return width-3; }
+
+  ///Prepares the ring for finding receivers. Walls are raised first, so that
+  ///the copies across the wrap carry the walls of the north and south edges.
+  template<class Layout, class State>
+  void Refresh(const Layout &layout, State &state, const int width, const int height) const {
+    typedef typename State::elev_t elev_t;
+    const elev_t wall = std::numeric_limits<elev_t>::max();
+    if(north==Edge::NO_FLUX)
+      for(int x=1;x<width-1;x++)  state.h(layout.index(x,1       )) = wall;
+    if(south==Edge::NO_FLUX)
+      for(int x=1;x<width-1;x++)  state.h(layout.index(x,height-2)) = wall;
+    if(west==Edge::NO_FLUX)
+      for(int y=1;y<height-1;y++) state.h(layout.index(1,      y)) = wall;
+    if(east==Edge::NO_FLUX)
+      for(int y=1;y<height-1;y++) state.h(layout.index(width-2,y)) = wall;
+    if(periodic()){
+      for(int y=1;y<height-1;y++){
+        state.h(layout.index(1,      y)) = state.h(layout.index(WrapEast(width),y));
+        state.h(layout.index(width-2,y)) = state.h(layout.index(WrapWest(),y));
+      }
+    }
+  }
+
+  ///Redirects receivers which point into the copies made by Refresh() across
+  ///the wrap
+  template<class Layout, class State>
+  void WrapReceivers(const Layout &layout, State &state, const int width, const int height) const {
+    if(!periodic())
+      return;
+    for(int y=2;y<height-2;y++){
+      int &wrec = state.rec(layout.index(WrapWest(),y));
+      if(wrec==0 || wrec==1 || wrec==7)
+        wrec += 8;
+      int &erec = state.rec(layout.index(WrapEast(width),y));
+      if(erec==3 || erec==4 || erec==5)
+        erec += 8;
+    }
+  }
+
+  ///Puts the ring back at sea level
+  template<class Layout, class State>
+  void Restore(const Layout &layout, State &state, const int width, const int height) const {
+    for(int x=1;x<width-1;x++){
+      state.h(layout.index(x,1       )) = 0;
+      state.h(layout.index(x,height-2)) = 0;
+    }
+    for(int y=1;y<height-1;y++){
+      state.h(layout.index(1,      y)) = 0;
+      state.h(layout.index(width-2,y)) = 0;
+    }
+  }
+
+  ///Four letters as taken by parse(), for logging
+  std::string name() const {
+    return std::string()+Letter(north)+Letter(east)+Letter(south)+Letter(west);
+  }
+
+ private:
+  static char Letter(const Edge e){
+    switch(e){
+      case Edge::OPEN:     return 'O';
+      case Edge::NO_FLUX:  return 'N';
+      case Edge::PERIODIC: return 'P';
+      default:             return '?';
+    }
+  }
+};
+
+#endif
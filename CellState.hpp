@@ -0,0 +1,210 @@
+//This file contains policies for how a model lays out the state it keeps for
+//each cell: its height, flow accumulation, erosion prefactor, receiver
+//direction, and number of donors. A model which is templated on its policy
+//reaches these fields only through the accessors below, so the layout can be
+//changed without touching the model's logic. The cells are numbered by the
+//model's grid layout (see GridLayout.hpp); this only decides where each cell's
+//fields live and how precisely they are stored.
+//
+//Every policy is templated on `elev_t`, the type used to store heights and
+//erosion prefactors, and `accum_t`, the type used to store and sum flow
+//accumulation. Both default to double. Arithmetic other than the summing of
+//flow accumulation is done in double whatever the storage type (see
+//fastscape_RB+PT.cpp).
+//
+//Cells are indexed by std::size_t, so a policy serves models using either 32-
+//or 64-bit indices.
+//
+//Every policy exposes the same interface:
+//    h(c), accum(c), efact(c), rec(c), ndon(c)
+//                            References to the fields of cell c
+//    AllocateHeights(n)      Makes room for the heights of n cells
+//    AllocateWorkspace(n)    Makes room for the other fields of n cells
+//    FreeWorkspace()         Frees what it can of the other fields, keeping the
+//                            heights
+//    CONTIGUOUS              True if the heights of consecutive cells are
+//                            adjacent doubles and their receivers adjacent
+//                            ints, in which case h_data() and rec_data() may be
+//                            handed to the vectorized receiver kernels (see
+//                            ReceiverKernels.hpp)
+#ifndef _cell_state_hpp_
+#define _cell_state_hpp_
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+///Short name of a storage type, for logging
+template<class T>
+std::string PrecisionName(){
+  return std::is_same<T,float>::value ? "f32" : "f64";
+}
+
+
+
+///Struct of arrays: each field is kept in an array of its own. A stage which
+///sweeps one or two fields over the whole DEM reads only those, and reads them
+///with unit stride. A stage which visits cells in flow order, such as erosion,
+///touches a separate cache line for each field of each cell.
+template<class elev_t_=double, class accum_t_=double>
+class SoAState {
+ public:
+  typedef elev_t_  elev_t;
+  typedef accum_t_ accum_t;
+
+ private:
+  std::vector<elev_t>  h_;     //Digital elevation model (height)
+  std::vector<accum_t> accum_; //Flow accumulation at each point
+  std::vector<elev_t>  efact_; //Prefactor of the implicit erosion equation at each cell
+  std::vector<int>     rec_;   //Direction of receiving cell
+  std::vector<int>     ndon_;  //How many donors a cell has
+
+ public:
+  static constexpr bool CONTIGUOUS = std::is_same<elev_t,double>::value;
+
+  elev_t  &h    (const std::size_t c)       { return h_    [c]; }
+  elev_t   h    (const std::size_t c) const { return h_    [c]; }
+  accum_t &accum(const std::size_t c)       { return accum_[c]; }
+  elev_t  &efact(const std::size_t c)       { return efact_[c]; }
+  int     &rec  (const std::size_t c)       { return rec_  [c]; }
+  int     &ndon (const std::size_t c)       { return ndon_ [c]; }
+
+  elev_t *h_data()   { return h_.data();   }
+  int    *rec_data() { return rec_.data(); }
+
+  void AllocateHeights(const std::size_t n){
+    h_.resize(n);
+  }
+
+  void AllocateWorkspace(const std::size_t n){
+    accum_.resize(n);
+    efact_.resize(n);
+    rec_  .resize(n);
+    ndon_ .resize(n);
+  }
+
+  void FreeWorkspace(){
+    accum_.clear(); accum_.shrink_to_fit();
+    efact_.clear(); efact_.shrink_to_fit();
+    rec_  .clear(); rec_  .shrink_to_fit();
+    ndon_ .clear(); ndon_ .shrink_to_fit();
+  }
+
+  std::string name() const {
+    return "SoA";
+  }
+};
+
+
+
+///Array of structs: all of a cell's fields are packed into one record (32 bytes
+///in double precision), so visiting a cell in flow order touches a single
+///cache line. Sweeps over one field read the other fields along with it, and
+///the heights are not contiguous, so receivers are found by scalar code. The
+///heights cannot be kept without the rest of the record, so FreeWorkspace()
+///frees nothing.
+template<class elev_t_=double, class accum_t_=double>
+class AoSState {
+ public:
+  typedef elev_t_  elev_t;
+  typedef accum_t_ accum_t;
+
+ private:
+  //The widest field comes first so that no padding is needed
+  struct Cell {
+    accum_t accum;
+    elev_t  h;
+    elev_t  efact;
+    int     rec;
+    int     ndon;
+  };
+  std::vector<Cell> cells;
+
+ public:
+  static constexpr bool CONTIGUOUS = false;
+
+  elev_t  &h    (const std::size_t c)       { return cells[c].h;     }
+  elev_t   h    (const std::size_t c) const { return cells[c].h;     }
+  accum_t &accum(const std::size_t c)       { return cells[c].accum; }
+  elev_t  &efact(const std::size_t c)       { return cells[c].efact; }
+  int     &rec  (const std::size_t c)       { return cells[c].rec;   }
+  int     &ndon (const std::size_t c)       { return cells[c].ndon;  }
+
+  elev_t *h_data()   { return nullptr; }
+  int    *rec_data() { return nullptr; }
+
+  void AllocateHeights(const std::size_t n){
+    cells.resize(n);
+  }
+
+  void AllocateWorkspace(const std::size_t n){
+    cells.resize(n);
+  }
+
+  void FreeWorkspace(){}
+
+  std::string name() const {
+    return "AoS";
+  }
+};
+
+
+
+///Array of structs of arrays: blocks of BLOCK consecutive cells, each holding an
+///array of BLOCK values for each field. A block is 256 bytes in double
+///precision, so one cell's fields lie on four cache lines which it shares with
+///the rest of its block, while a sweep over one field still reads runs of BLOCK
+///values with unit stride. As with AoSState, the heights are not contiguous
+///across blocks and FreeWorkspace() frees nothing.
+template<class elev_t_=double, class accum_t_=double>
+class AoSoAState {
+ public:
+  typedef elev_t_  elev_t;
+  typedef accum_t_ accum_t;
+
+  static constexpr int BLOCK = 8; //One AVX-512 register of doubles
+
+ private:
+  struct alignas(64) Block {
+    elev_t  h    [BLOCK];
+    accum_t accum[BLOCK];
+    elev_t  efact[BLOCK];
+    int     rec  [BLOCK];
+    int     ndon [BLOCK];
+  };
+  std::vector<Block> blocks;
+
+  //Cell indices are unsigned, so these are a shift and a mask
+  static std::size_t BlockOf(const std::size_t c){ return c/BLOCK; }
+  static std::size_t LaneOf (const std::size_t c){ return c%BLOCK; }
+
+ public:
+  static constexpr bool CONTIGUOUS = false;
+
+  elev_t  &h    (const std::size_t c)       { return blocks[BlockOf(c)].h    [LaneOf(c)]; }
+  elev_t   h    (const std::size_t c) const { return blocks[BlockOf(c)].h    [LaneOf(c)]; }
+  accum_t &accum(const std::size_t c)       { return blocks[BlockOf(c)].accum[LaneOf(c)]; }
+  elev_t  &efact(const std::size_t c)       { return blocks[BlockOf(c)].efact[LaneOf(c)]; }
+  int     &rec  (const std::size_t c)       { return blocks[BlockOf(c)].rec  [LaneOf(c)]; }
+  int     &ndon (const std::size_t c)       { return blocks[BlockOf(c)].ndon [LaneOf(c)]; }
+
+  elev_t *h_data()   { return nullptr; }
+  int    *rec_data() { return nullptr; }
+
+  void AllocateHeights(const std::size_t n){
+    blocks.resize((n+BLOCK-1)/BLOCK);
+  }
+
+  void AllocateWorkspace(const std::size_t n){
+    blocks.resize((n+BLOCK-1)/BLOCK);
+  }
+
+  void FreeWorkspace(){}
+
+  std::string name() const {
+    return "AoSoA";
+  }
+};
+
+#endif
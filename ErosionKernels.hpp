@@ -0,0 +1,302 @@
+//This file contains kernels which solve the implicit stream power equation for
+//a single cell. Given the cell's elevation before erosion, h0, the new
+//elevation of its receiver, hn, and the constant factor fact=K*dt*A^m/L^n,
+//each finds the new elevation h of the cell such that
+//    h - h0 + fact*(h-hn)^n = 0
+//For n=1 and n=2 this has a closed-form solution. Newton-Raphson iteration is
+//kept for all other exponents. PowPositive() takes the powers, such as A^m for
+//the prefactor, in a form the compiler can vectorize. The kernels are inline so
+//that OpenACC can compile them for the device as well as the host.
+#ifndef _erosion_kernels_hpp_
+#define _erosion_kernels_hpp_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _OPENACC
+  #define EROSION_KERNEL _Pragma("acc routine seq")
+#else
+  #define EROSION_KERNEL
+#endif
+
+///Reinterprets the bits of a double as an integer and back. Used by
+///PowPositive().
+EROSION_KERNEL
+inline uint64_t DoubleBits(const double x){
+  uint64_t b;
+  std::memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+EROSION_KERNEL
+inline double BitsDouble(const uint64_t b){
+  double x;
+  std::memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+///Returns x^e for positive, normal x with |e*log(x)|<700, as exp(e*log(x)).
+///std::pow is an opaque library call, so a loop containing it cannot be
+///vectorized. This uses only arithmetic and bit manipulation, so it can. The
+///logarithm is that of fdlibm; the exponential reduces its argument by a
+///multiple of log(2) and sums the Taylor series of what is left. The relative
+///error is a few units in the last place, growing with |e*log(x)|; it is checked
+///at run time by PowPositiveError().
+EROSION_KERNEL
+inline double PowPositive(const double x, const double e){
+  const double LN2_HI = 6.93147180369123816490e-01; //log(2) split so that k*LN2_HI is exact
+  const double LN2_LO = 1.90821492927058770002e-10;
+
+  //log(x): write x=2^k*m with m in [sqrt(2)/2,sqrt(2)), so log(x)=k*log(2)+log(m)
+  uint64_t bits = DoubleBits(x);
+  bits += UINT64_C(0x3ff0000000000000)-UINT64_C(0x3fe6a09e00000000);
+  const double k = BitsDouble(UINT64_C(0x4330000000000000) | (bits>>52)) - 4503599627370496.0 - 1023;
+  bits = (bits & UINT64_C(0x000fffffffffffff)) + UINT64_C(0x3fe6a09e00000000);
+  const double f    = BitsDouble(bits)-1;
+  const double hfsq = 0.5*f*f;
+  const double s    = f/(2+f);
+  const double z    = s*s;
+  const double w    = z*z;
+  const double t1   = w*(3.999999999940941908e-01+w*(2.222219843214978396e-01+w*1.531383769920937332e-01));
+  const double t2   = z*(6.666666666666735130e-01+w*(2.857142874366239149e-01+w*(1.818357216161805012e-01+w*1.479819860511658591e-01)));
+  const double logx = s*(hfsq+t1+t2) + k*LN2_LO - hfsq + f + k*LN2_HI;
+
+  //exp(y): write y=j*log(2)+r with |r|<=log(2)/2, so exp(y)=2^j*exp(r). Adding
+  //1.5*2^52 rounds y/log(2) to the integer j and leaves j in the low bits.
+  const double y     = e*logx;
+  const double shift = 6755399441055744.0;
+  const double t     = y*1.44269504088896338700e+00 + shift;
+  const double j     = t-shift;
+  const double r     = (y-j*LN2_HI)-j*LN2_LO;
+  double p = 1.0/6227020800;       //1/13!
+  p = p*r + 1.0/479001600;
+  p = p*r + 1.0/39916800;
+  p = p*r + 1.0/3628800;
+  p = p*r + 1.0/362880;
+  p = p*r + 1.0/40320;
+  p = p*r + 1.0/5040;
+  p = p*r + 1.0/720;
+  p = p*r + 1.0/120;
+  p = p*r + 1.0/24;
+  p = p*r + 1.0/6;
+  p = p*r + 0.5;
+  p = p*r + 1;
+  p = p*r + 1;
+  return p*BitsDouble((DoubleBits(t)+1023)<<52);
+}
+
+///The largest relative difference between PowPositive(x,e) and std::pow(x,e)
+///over x from 1e-6 to 1e15, which covers flow accumulations on any DEM which
+///fits in memory. Callers check this before relying on PowPositive().
+inline double PowPositiveError(const double e){
+  double max_error = 0;
+  for(int i=0;i<=100000;i++){
+    const double x     = std::pow(10.0, -6+21*(i/100000.0));
+    const double exact = std::pow(x,e);
+    max_error = std::max(max_error, std::abs(PowPositive(x,e)-exact)/exact);
+  }
+  return max_error;
+}
+
+///n=1: the equation is linear in h
+EROSION_KERNEL
+inline double ErodeCellLinear(const double h0, const double hn, const double fact){
+  return (h0+fact*hn)/(1+fact);
+}
+
+///n=2: the equation is a quadratic in the drop s=h-hn,
+///    fact*s^2 + s - (h0-hn) = 0
+///whose positive root is written so as to avoid cancellation when fact*(h0-hn)
+///is small. The receiver is always lower than the cell, so h0-hn>0.
+EROSION_KERNEL
+inline double ErodeCellQuadratic(const double h0, const double hn, const double fact){
+  const double drop = h0-hn;
+  return hn + 2*drop/(1+std::sqrt(1+4*fact*drop));
+}
+
+///Newton-Raphson iteration starting from `guess`, run until subsequent values
+///differ by less than `tol`. The number of iterations is stored in
+///`iterations`. A guess at or below the receiver is replaced by h0, since
+///(h-hn)^n need not be defined there.
+EROSION_KERNEL
+inline double ErodeCellNewtonFrom(const double h0, const double hn, const double fact, const double neq, const double tol, const double guess, int &iterations){
+  double hnew = (guess>hn) ? guess : h0; //Current updated value of focal cell
+  double hp   = hnew;                    //Previous updated value of focal cell
+  double diff = 2*tol;                   //Difference between current and previous updated values
+  iterations  = 0;
+  while(std::abs(diff)>tol){
+    hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
+    diff  = hnew - hp;
+    hp    = hnew;
+    iterations++;
+  }
+  return hnew;
+}
+
+///General n: Newton-Raphson iteration starting from h0
+EROSION_KERNEL
+inline double ErodeCellNewton(const double h0, const double hn, const double fact, const double neq, const double tol){
+  int iterations;
+  return ErodeCellNewtonFrom(h0, hn, fact, neq, tol, h0, iterations);
+}
+
+///Number of cells solved together by ErodeCellsNewton(): one AVX-512 register,
+///or two AVX2 registers, of doubles
+constexpr int EROSION_BATCH = 8;
+
+///Newton-Raphson iteration for a batch of `nlanes`<=EROSION_BATCH independent
+///cells, such as those of one level, with the same arguments as
+///ErodeCellNewton() laid out one cell per lane. Each iteration updates every
+///lane at once so that the compiler can vectorize it, which is why the powers
+///are taken with PowPositive() rather than std::pow; callers check
+///PowPositiveError() for `neq` and `neq-1`. A lane stops changing once it has
+///converged, so each lane takes the same steps as ErodeCellNewton() and its
+///result differs only by PowPositive()'s rounding. The lanes past `nlanes` are
+///padded with a cell which converges at once. Returns the number of iterations
+///run, which is that of the slowest lane.
+inline int ErodeCellsNewton(
+  const double *const h0,
+  const double *const hn,
+  const double *const fact,
+  double *const hnew,
+  const int nlanes,
+  const double neq,
+  const double tol
+){
+  double lh0  [EROSION_BATCH];
+  double lhn  [EROSION_BATCH];
+  double lfact[EROSION_BATCH];
+  double lnew [EROSION_BATCH];
+  int    live [EROSION_BATCH]; //1 if the lane has not yet converged
+
+  for(int l=0;l<EROSION_BATCH;l++){
+    lh0  [l] = (l<nlanes) ? h0  [l] : 1;
+    lhn  [l] = (l<nlanes) ? hn  [l] : 0;
+    lfact[l] = (l<nlanes) ? fact[l] : 0;
+    lnew [l] = lh0[l];
+    live [l] = 1;
+  }
+
+  int iterations = 0;
+  int nlive      = EROSION_BATCH;
+  while(nlive>0){
+    nlive = 0;
+    #pragma omp simd reduction(+:nlive)
+    for(int l=0;l<EROSION_BATCH;l++){
+      const double drop = lnew[l]-lhn[l];
+      const double next = lnew[l] - (lnew[l]-lh0[l]+lfact[l]*PowPositive(drop,neq))/(1.+lfact[l]*neq*PowPositive(drop,neq-1));
+      const int    keep = live[l] && std::abs(next-lnew[l])>tol;
+      lnew[l] = live[l] ? next : lnew[l];
+      live[l] = keep;
+      nlive  += keep;
+    }
+    iterations++;
+  }
+
+  for(int l=0;l<nlanes;l++)
+    hnew[l] = lnew[l];
+
+  return iterations;
+}
+
+///Chooses the kernel for the exponent `neq`. The exponent is the same for every
+///cell, so the branch is perfectly predicted.
+EROSION_KERNEL
+inline double ErodeCellImplicit(const double h0, const double hn, const double fact, const double neq, const double tol){
+  if(neq==1)
+    return ErodeCellLinear(h0, hn, fact);
+  else if(neq==2)
+    return ErodeCellQuadratic(h0, hn, fact);
+  else
+    return ErodeCellNewton(h0, hn, fact, neq, tol);
+}
+
+
+
+///The height fact*(h-hn)^n eroded from a cell at height h, choosing the kernel
+///for the exponent `neq` as ErodeCellImplicit() does
+EROSION_KERNEL
+inline double ErodedHeight(const double h, const double hn, const double fact, const double neq){
+  const double drop = h-hn;
+  if(neq==1)
+    return fact*drop;
+  else if(neq==2)
+    return fact*(drop*drop);
+  else
+    return fact*std::pow(drop,neq);
+}
+
+///The derivative of ErodedHeight() with respect to h
+EROSION_KERNEL
+inline double ErodedHeightDerivative(const double h, const double hn, const double fact, const double neq){
+  const double drop = h-hn;
+  if(neq==1)
+    return fact;
+  else if(neq==2)
+    return 2*fact*drop;
+  else
+    return fact*neq*std::pow(drop,neq-1);
+}
+
+
+
+//Exponent policies. A model whose slope exponent is set at run time hands one
+//of these to the loop which uses it, chosen once per pass. A fixed exponent is
+//a compile-time constant, so the loop needs no branch on it and the compiler
+//can fold it into the arithmetic. The runtime policy serves any other value.
+//
+//Besides solving the equation, each policy gives the height eroded from a cell
+//at height h, E(h)=fact*(h-hn)^n, and dE/dh, for erosion laws built on it (see
+//ErosionLaws.hpp).
+
+///Solves the implicit erosion equation for a fixed n of 1 or 2, which have
+///closed forms
+template<int N>
+struct ErodeCellFixedN;
+
+template<>
+struct ErodeCellFixedN<1> {
+  double operator()(const double h0, const double hn, const double fact) const {
+    return ErodeCellLinear(h0, hn, fact);
+  }
+  double eroded(const double h, const double hn, const double fact) const {
+    return fact*(h-hn);
+  }
+  double eroded_derivative(const double, const double, const double fact) const {
+    return fact;
+  }
+};
+
+template<>
+struct ErodeCellFixedN<2> {
+  double operator()(const double h0, const double hn, const double fact) const {
+    return ErodeCellQuadratic(h0, hn, fact);
+  }
+  double eroded(const double h, const double hn, const double fact) const {
+    return fact*((h-hn)*(h-hn));
+  }
+  double eroded_derivative(const double h, const double hn, const double fact) const {
+    return 2*fact*(h-hn);
+  }
+};
+
+///Solves the implicit erosion equation for any n, choosing the kernel for each
+///cell as ErodeCellImplicit() does
+struct ErodeCellRuntimeN {
+  double neq;
+  double tol;
+  ErodeCellRuntimeN(const double neq0, const double tol0) : neq(neq0), tol(tol0) {}
+  double operator()(const double h0, const double hn, const double fact) const {
+    return ErodeCellImplicit(h0, hn, fact, neq, tol);
+  }
+  double eroded(const double h, const double hn, const double fact) const {
+    return ErodedHeight(h, hn, fact, neq);
+  }
+  double eroded_derivative(const double h, const double hn, const double fact) const {
+    return ErodedHeightDerivative(h, hn, fact, neq);
+  }
+};
+
+#endif
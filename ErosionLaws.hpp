@@ -0,0 +1,233 @@
+//This file contains erosion laws: policies which tell a model how to find the
+//new height of a cell during the implicit erosion step. A model which is
+//templated on its law calls it through ErodeCellByLaw() for every cell, so a
+//law's functions are inlined into the model's loop over cells and a custom law
+//costs no more per cell than the built-in one.
+//
+//Every law solves an implicit equation for the new height h of cell c of the
+//form
+//    r(h) = h - h0 + E(h) = 0
+//where h0 is the height before erosion, hn the new height of the receiver, and
+//E(h)>=0 the height eroded over the timestep, which grows with h. `fact` is the
+//model's prefactor K*dt*A^m/L^n for the cell (see ErosionKernels.hpp), which a
+//law may adjust per cell.
+//
+//Every law exposes the same interface:
+//    HAS_SOLVE               True if solve() finds the root itself, in closed
+//                            form where it can. Otherwise ErodeCellByLaw() runs
+//                            Newton-Raphson iteration on residual() and
+//                            derivative(), starting from h0, to tolerance `tol`
+//                            (see NewtonLaw).
+//    prefactor(c,rec,fact)   The prefactor for cell c, whose receiver is in
+//                            direction rec, given the model's prefactor fact
+//    residual(c,h,h0,hn,fact)
+//                            r(h)
+//    derivative(c,h,hn,fact) dr/dh
+//    solve(c,h0,hn,fact)     The root of r (only if HAS_SOLVE)
+//    tol                     Newton-Raphson tolerance
+//    name()                  Short description, for logging
+#ifndef _erosion_laws_hpp_
+#define _erosion_laws_hpp_
+
+#include "ErosionKernels.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+template<class Law>
+double SolveLaw(const Law &law, const std::size_t c, const double h0, const double hn, const double fact, std::true_type){
+  return law.solve(c, h0, hn, fact);
+}
+
+///Newton-Raphson iteration as in ErodeCellNewton(), on the law's residual
+template<class Law>
+double SolveLaw(const Law &law, const std::size_t c, const double h0, const double hn, const double fact, std::false_type){
+  double hnew = h0;       //Current updated value of focal cell
+  double hp   = hnew;     //Previous updated value of focal cell
+  double diff = 2*law.tol; //Difference between current and previous updated values
+  while(std::abs(diff)>law.tol){
+    hnew -= law.residual(c, hnew, h0, hn, fact)/law.derivative(c, hnew, hn, fact);
+    diff  = hnew - hp;
+    hp    = hnew;
+  }
+  return hnew;
+}
+
+///Solves the law's equation for a cell with the given height h0, receiver
+///height hn, and model prefactor fact
+template<class Law>
+double SolveLaw(const Law &law, const std::size_t c, const double h0, const double hn, const double fact){
+  return SolveLaw(law, c, h0, hn, fact, std::integral_constant<bool,Law::HAS_SOLVE>());
+}
+
+///Returns the new height of cell c, whose receiver is in direction rec
+template<class Law>
+double ErodeCellByLaw(const Law &law, const std::size_t c, const int rec, const double h0, const double hn, const double fact){
+  return SolveLaw(law, c, h0, hn, law.prefactor(c, rec, fact));
+}
+
+
+
+///Detachment-limited stream power, E(h) = fact*(h-hn)^n, with n that of
+///`Solver`: ErodeCellFixedN<1>, ErodeCellFixedN<2>, or ErodeCellRuntimeN (see
+///ErosionKernels.hpp), which also solves it. This is the law the other variants
+///hard-code.
+template<class Solver>
+struct StreamPowerLaw {
+  static constexpr bool HAS_SOLVE = true;
+
+  Solver solver;
+  double tol;
+
+  StreamPowerLaw(const Solver solver0, const double tol0)
+    : solver(solver0), tol(tol0) {}
+
+  double prefactor(const std::size_t, const int, const double fact) const {
+    return fact;
+  }
+
+  double residual(const std::size_t, const double h, const double h0, const double hn, const double fact) const {
+    return h-h0+solver.eroded(h, hn, fact);
+  }
+
+  double derivative(const std::size_t, const double h, const double hn, const double fact) const {
+    return 1.+solver.eroded_derivative(h, hn, fact);
+  }
+
+  double solve(const std::size_t, const double h0, const double hn, const double fact) const {
+    return solver(h0, hn, fact);
+  }
+
+  std::string name() const {
+    return "stream power";
+  }
+};
+
+
+
+///Wraps another law so that erosion only happens in excess of a threshold:
+///E(h) = max(0, E_inner(h) - dt*theta), where theta is the threshold rate of
+///erosion. Where E_inner(h0)<=dt*theta the cell is not eroded. Elsewhere the
+///root lies where E is smooth, and is that of the inner law for a cell which
+///starts dt*theta higher. E_inner(h) is the inner law's residual at h0=h, so
+///it costs what the inner law's residual does.
+template<class Inner>
+struct ThresholdLaw {
+  static constexpr bool HAS_SOLVE = true;
+
+  Inner  inner;
+  double dt_theta; //Height which the threshold withholds from erosion over a timestep
+  double tol;
+
+  ThresholdLaw(const Inner inner0, const double dt_theta0)
+    : inner(inner0), dt_theta(dt_theta0), tol(inner0.tol) {}
+
+  double prefactor(const std::size_t c, const int rec, const double fact) const {
+    return inner.prefactor(c, rec, fact);
+  }
+
+  double residual(const std::size_t c, const double h, const double h0, const double hn, const double fact) const {
+    const double eroded = inner.residual(c, h, h, hn, fact); //E_inner(h)
+    return h-h0+(eroded>dt_theta ? eroded-dt_theta : 0);
+  }
+
+  double derivative(const std::size_t c, const double h, const double hn, const double fact) const {
+    return (inner.residual(c, h, h, hn, fact)>dt_theta) ? inner.derivative(c, h, hn, fact) : 1;
+  }
+
+  double solve(const std::size_t c, const double h0, const double hn, const double fact) const {
+    if(inner.residual(c, h0, h0, hn, fact)<=dt_theta)
+      return h0;
+    return SolveLaw(inner, c, h0+dt_theta, hn, fact);
+  }
+
+  std::string name() const {
+    return inner.name()+" with threshold";
+  }
+};
+
+
+
+///Stream power with a separate K and n for each lithology. `lithology` gives
+///each cell's lithology, indexed as the model's cells are. The model's
+///prefactor was found with its own K and n, so it is rescaled by the lithology's
+///factor on K and by L^n_model/L^n_lithology. Since n varies between cells, it
+///is chosen per cell as in ErodeCellImplicit(). A K which varies smoothly, such
+///as that of a discharge-based law in which K multiplies runoff^m, is a
+///per-cell factor in prefactor() in the same way.
+struct LithologyLaw {
+  static constexpr bool HAS_SOLVE = true;
+
+  const uint8_t             *lithology; //Lithology of each cell
+  std::vector<double>        neq;       //Slope exponent of each lithology
+  std::vector<double>        rescale;   //Factor on the model's prefactor, by lithology*8+direction
+  double                     tol;
+
+  ///`kfactor` and `neq` give the factor on the model's K and the slope exponent
+  ///of each lithology; `dr` and `model_neq` are the model's
+  LithologyLaw(const uint8_t *const lithology0, const std::vector<double> &kfactor, const std::vector<double> &neq0, const double *const dr, const double model_neq, const double tol0)
+    : lithology(lithology0), neq(neq0), rescale(8*neq0.size()), tol(tol0)
+  {
+    for(std::size_t l=0;l<neq.size();l++)
+    for(int k=0;k<8;k++)
+      rescale[8*l+k] = kfactor[l]*std::pow(dr[k],model_neq)/std::pow(dr[k],neq[l]);
+  }
+
+  double prefactor(const std::size_t c, const int rec, const double fact) const {
+    return fact*rescale[8*lithology[c]+rec];
+  }
+
+  double residual(const std::size_t c, const double h, const double h0, const double hn, const double fact) const {
+    return h-h0+ErodedHeight(h, hn, fact, neq[lithology[c]]);
+  }
+
+  double derivative(const std::size_t c, const double h, const double hn, const double fact) const {
+    return 1.+ErodedHeightDerivative(h, hn, fact, neq[lithology[c]]);
+  }
+
+  double solve(const std::size_t c, const double h0, const double hn, const double fact) const {
+    return ErodeCellImplicit(h0, hn, fact, neq[lithology[c]], tol);
+  }
+
+  std::string name() const {
+    return "stream power by lithology";
+  }
+};
+
+
+
+///Wraps another law so that it is solved by Newton-Raphson iteration on its
+///residual, as a law without a closed form is, even where it has one. This
+///checks the iteration against the closed forms, and shows what a closed form
+///saves.
+template<class Inner>
+struct NewtonLaw {
+  static constexpr bool HAS_SOLVE = false;
+
+  Inner  inner;
+  double tol;
+
+  explicit NewtonLaw(const Inner inner0)
+    : inner(inner0), tol(inner0.tol) {}
+
+  double prefactor(const std::size_t c, const int rec, const double fact) const {
+    return inner.prefactor(c, rec, fact);
+  }
+
+  double residual(const std::size_t c, const double h, const double h0, const double hn, const double fact) const {
+    return inner.residual(c, h, h0, hn, fact);
+  }
+
+  double derivative(const std::size_t c, const double h, const double hn, const double fact) const {
+    return inner.derivative(c, h, hn, fact);
+  }
+
+  std::string name() const {
+    return inner.name()+" by Newton-Raphson";
+  }
+};
+
+#endif
@@ -0,0 +1,229 @@
+//This file contains the mappings between a cell's (x,y) coordinates and its
+//index in the flat arrays which store the DEM and the flow graph. A model which
+//is templated on its layout does all of its indexing through these classes,
+//so the storage order can be changed without touching the model's logic.
+//
+//Every layout is templated on `index_t`, the integer type of the flat indices.
+//It must be wide enough for the largest index the model derives from them (see
+//fastscape_RB+PT.cpp). Offsets between neighbours are always ints.
+//
+//Every layout exposes the same interface:
+//    size()                  Number of entries each per-cell array needs
+//    index(x,y)              Flat index of the cell at (x,y)
+//    neighbour(c,k)          Flat index of the neighbour of cell c in direction
+//                            k. Directions 8-15 are directions 0-7 taken across
+//                            the east-west wrap set by SetWrap().
+//    SetWrap(x_west,x_east)  Makes the columns x_west and x_east neighbours of
+//                            each other, for periodic boundaries (see
+//                            BoundaryConditions.hpp)
+//    ForEachRun(x0,x1,y0,y1,f)
+//                            Calls f(cstart,cend,shift) for runs of cells
+//                            covering the rectangle [x0,x1)x[y0,y1). The cells
+//                            of a run are contiguous in memory and all find
+//                            their neighbour in direction k at c+shift[k], so a
+//                            run can be handed to a receiver kernel (see
+//                            ReceiverKernels.hpp).
+//
+//Directions are numbered as everywhere else in this code:
+//    1 2 3
+//    0   4
+//    7 6 5
+#ifndef _grid_layout_hpp_
+#define _grid_layout_hpp_
+
+#include <algorithm>
+#include <array>
+#include <string>
+
+///The usual layout: rows are stored one after another. A neighbour is found at
+///a fixed offset of +-1 or +-width, so the 8-neighbour stencil touches three
+///rows which are far apart in memory on a large DEM.
+template<class index_t_=int>
+class RowMajorLayout {
+ public:
+  typedef index_t_ index_t;
+
+ private:
+  int width;
+  int height;
+  std::array<int,8>  nshift; //Offset from a focal cell's index to its neighbours
+  std::array<int,16> rshift; //As nshift, followed by the offsets across the wrap
+
+ public:
+  RowMajorLayout(const int width0, const int height0)
+    : width(width0), height(height0),
+      nshift{-1,-width0-1,-width0,-width0+1,1,width0+1,width0,width0-1}
+  {
+    for(int k=0;k<16;k++)
+      rshift[k] = nshift[k&7];
+  }
+
+  index_t size() const {
+    return static_cast<index_t>(width)*height;
+  }
+
+  index_t index(const int x, const int y) const {
+    return static_cast<index_t>(y)*width+x;
+  }
+
+  index_t neighbour(const index_t c, const int k) const {
+    return c+rshift[k];
+  }
+
+  ///A wrapped neighbour is in the same row as the unwrapped one, shifted from
+  ///just outside one wrapped column to the other
+  void SetWrap(const int x_west, const int x_east){
+    for(const int k: {0,1,7})
+      rshift[8+k] = nshift[k] + (x_east-(x_west-1));
+    for(const int k: {3,4,5})
+      rshift[8+k] = nshift[k] + (x_west-(x_east+1));
+  }
+
+  ///Each row of the rectangle is a single run
+  template<class F>
+  void ForEachRun(const int x0, const int x1, const int y0, const int y1, F f) const {
+    for(int y=y0;y<y1;y++)
+      f(index(x0,y), index(x1,y), nshift);
+  }
+
+  std::string name() const {
+    return "row-major";
+  }
+};
+
+
+
+///The DEM is divided into square tiles of TILE x TILE cells. Each tile is
+///stored contiguously, row-major within the tile, and the tiles are stored
+///row-major. A cell's whole 8-neighbourhood then usually lies within one tile,
+///whose heights (128 KiB) fit in L2 cache and span 32 4 KiB pages, and a
+///receiver is usually in the same tile as its donors, which helps the stages
+///which walk the flow graph as well as those which sweep the stencil. Smaller
+///tiles split their rows into runs too short for the receiver kernels to
+///vectorize well.
+///
+///Tiles have no halos of their own: the halo ring around the DEM is kept as in
+///the row-major layout, and a cell on the edge of a tile finds its neighbour in
+///the adjacent tile. Since x and y contribute separately to a cell's index, the
+///offset to a neighbour depends only on whether the cell is on the low edge,
+///the inside, or the high edge of its tile in each of x and y. The nine sets of
+///offsets are computed once. The DEM is padded up to a whole number of tiles;
+///padding cells are never the neighbour of a cell which is processed.
+template<class index_t_=int>
+class TiledLayout {
+ public:
+  typedef index_t_ index_t;
+
+  static constexpr int TILE_BITS = 7;              //log2 of the tile's edge length
+  static constexpr int TILE      = 1<<TILE_BITS;   //Edge length of a tile
+  static constexpr int TILE_MASK = TILE-1;
+
+ private:
+  int width;
+  int height;
+  int tiles_x;   //Number of tiles in a row of tiles
+  int tiles_y;   //Number of rows of tiles
+  std::array<std::array<int,8>,9>  nshift; //Offsets to neighbours, by ShiftClass()
+  std::array<std::array<int,16>,9> rshift; //As nshift, followed by the offsets across the wrap
+
+  ///0, 1, or 2 as a cell's x or y within its tile is on the low edge, inside,
+  ///or on the high edge of the tile
+  static int EdgeClass(const int l){
+    return (l!=0) + (l==TILE_MASK);
+  }
+
+  ///Which of the nine sets of offsets in `nshift` apply to cell c
+  int ShiftClass(const index_t c) const {
+    return 3*EdgeClass(static_cast<int>((c>>TILE_BITS)&TILE_MASK)) + EdgeClass(static_cast<int>(c&TILE_MASK));
+  }
+
+ public:
+  TiledLayout(const int width0, const int height0)
+    : width(width0), height(height0),
+      tiles_x((width0 +TILE-1)>>TILE_BITS),
+      tiles_y((height0+TILE-1)>>TILE_BITS)
+  {
+    const int dx[8] = {-1,-1, 0, 1,1,1,0,-1};
+    const int dy[8] = { 0,-1,-1,-1,0,1,1, 1};
+    //Stepping one cell in x or y either stays within the tile or crosses into
+    //the adjacent tile, landing on the opposite edge
+    const int x_inside = 1;
+    const int x_across = TILE*TILE-TILE_MASK;
+    const int y_inside = TILE;
+    const int y_across = tiles_x*TILE*TILE-TILE_MASK*TILE;
+    for(int ycls=0;ycls<3;ycls++)
+    for(int xcls=0;xcls<3;xcls++)
+    for(int k=0;k<8;k++){
+      int offset = 0;
+      if(dx[k]<0) offset -= (xcls==0) ? x_across : x_inside;
+      if(dx[k]>0) offset += (xcls==2) ? x_across : x_inside;
+      if(dy[k]<0) offset -= (ycls==0) ? y_across : y_inside;
+      if(dy[k]>0) offset += (ycls==2) ? y_across : y_inside;
+      nshift[3*ycls+xcls][k] = offset;
+    }
+    for(int cls=0;cls<9;cls++)
+    for(int k=0;k<16;k++)
+      rshift[cls][k] = nshift[cls][k&7];
+  }
+
+  index_t size() const {
+    return static_cast<index_t>(tiles_x)*tiles_y*TILE*TILE;
+  }
+
+  index_t index(const int x, const int y) const {
+    const index_t tile = static_cast<index_t>(y>>TILE_BITS)*tiles_x + (x>>TILE_BITS);
+    return (tile<<(2*TILE_BITS)) | ((y&TILE_MASK)<<TILE_BITS) | (x&TILE_MASK);
+  }
+
+  index_t neighbour(const index_t c, const int k) const {
+    return c+rshift[ShiftClass(c)][k];
+  }
+
+  ///A wrapped neighbour is in the same row as the unwrapped one, shifted from
+  ///just outside one wrapped column to the other. Within a row of tiles, the
+  ///difference between the indices of two columns does not depend on the row.
+  void SetWrap(const int x_west, const int x_east){
+    const int west_delta = static_cast<int>(index(x_east,0)-index(x_west-1,0));
+    const int east_delta = static_cast<int>(index(x_west,0)-index(x_east+1,0));
+    for(int cls=0;cls<9;cls++){
+      for(const int k: {0,1,7})
+        rshift[cls][8+k] = nshift[cls][k] + west_delta;
+      for(const int k: {3,4,5})
+        rshift[cls][8+k] = nshift[cls][k] + east_delta;
+    }
+  }
+
+  ///Visits the rectangle tile by tile. Each row of a tile is split into the
+  ///cells on its low edge, inside, and high edge, since these have different
+  ///offsets to their neighbours.
+  template<class F>
+  void ForEachRun(const int x0, const int x1, const int y0, const int y1, F f) const {
+    for(int ty=(y0>>TILE_BITS);ty<=((y1-1)>>TILE_BITS);ty++)
+    for(int tx=(x0>>TILE_BITS);tx<=((x1-1)>>TILE_BITS);tx++){
+      const int xa = std::max(x0,tx*TILE);
+      const int xb = std::min(x1,tx*TILE+TILE);
+      const int ya = std::max(y0,ty*TILE);
+      const int yb = std::min(y1,ty*TILE+TILE);
+      for(int y=ya;y<yb;y++){
+        const int row = 3*EdgeClass(y&TILE_MASK);
+        const index_t c = index(xa,y); //First cell of this row of the tile
+        int x = xa;
+        if((x&TILE_MASK)==0){          //Low edge
+          f(c, c+1, nshift[row+0]);
+          x++;
+        }
+        const int xin = std::min(xb,tx*TILE+TILE_MASK); //End of the inside
+        if(x<xin)
+          f(c+(x-xa), c+(xin-xa), nshift[row+1]);
+        if(xb==tx*TILE+TILE)           //High edge
+          f(c+(xb-1-xa), c+(xb-xa), nshift[row+2]);
+      }
+    }
+  }
+
+  std::string name() const {
+    return "tiled "+std::to_string(TILE)+"x"+std::to_string(TILE);
+  }
+};
+
+#endif
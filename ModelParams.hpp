@@ -0,0 +1,141 @@
+//This file contains the physical parameters of the model, which a run may set
+//from a parameter file or the command line rather than having them compiled in.
+//Their defaults are the constants the other variants use, so a run which sets
+//nothing produces the same output as they do.
+//
+//A parameter file holds one `name = value` pair per line. Blank lines and
+//anything following a `#` are ignored. The names are those of the members of
+//ModelParams below. All values are numbers except that of `boundary`, which is
+//as taken by BoundaryConditions::parse().
+#ifndef _model_params_hpp_
+#define _model_params_hpp_
+
+#include "BoundaryConditions.hpp"
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+struct ModelParams {
+  double keq       = 2e-6;   //Stream power equation constant (coefficient)
+  double neq       = 2;      //Stream power equation constant (slope modifier)
+  double meq       = 0.8;    //Stream power equation constant (area modifier)
+  double ueq       = 2e-3;   //Rate of uplift
+  double dt        = 1000.;  //Timestep interval
+  double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
+  double cell_area = 40000;  //Area of a single cell
+
+  //Variations on the erosion law (see ErosionLaws.hpp). The defaults leave the
+  //law as it is in the other variants.
+  double threshold     = 0;   //Rate of erosion below which no erosion happens
+  double hard_fraction = 0;   //Fraction of the DEM's width, on its east side, which is hard rock
+  double hard_kfactor  = 0.5; //Factor on keq for hard rock
+  double hard_neq      = 1;   //Slope exponent for hard rock
+
+  BoundaryConditions boundary; //What happens to flow at each edge of the DEM; all open by default
+
+  ///Sets the parameter called `name` from the text `value`. Returns false, and
+  ///changes nothing, if there is no such parameter or `value` is not a number.
+  bool set(const std::string &name, const std::string &value){
+    if(name=="boundary")
+      return boundary.parse(value);
+    double *const param = find(name);
+    if(!param)
+      return false;
+    try {
+      std::size_t used;
+      const double v = std::stod(value, &used);
+      if(used!=value.size())
+        return false;
+      *param = v;
+    } catch(const std::exception &) {
+      return false;
+    }
+    return true;
+  }
+
+  ///True if `name` is the name of a parameter
+  bool has(const std::string &name) {
+    return name=="boundary" || find(name)!=nullptr;
+  }
+
+  ///Sets the parameters listed in a parameter file. Returns false, having
+  ///printed the offending line, if the file cannot be read or a line is not a
+  ///valid `name = value` pair.
+  bool load(const std::string &filename){
+    std::ifstream fin(filename.c_str());
+    if(!fin.good()){
+      std::cerr<<"E Could not open parameter file '"<<filename<<"'"<<std::endl;
+      return false;
+    }
+    std::string line;
+    for(int lineno=1;std::getline(fin,line);lineno++){
+      line = Trim(line.substr(0,line.find('#')));
+      if(line.empty())
+        continue;
+      const auto eq = line.find('=');
+      if(eq==std::string::npos || !set(Trim(line.substr(0,eq)), Trim(line.substr(eq+1)))){
+        std::cerr<<"E "<<filename<<":"<<lineno<<": not a valid parameter: "<<line<<std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  ///Returns false, having printed why, if the parameters are ones the model
+  ///cannot run with
+  bool validate() const {
+    if(!(neq>0 && tol>0 && dt>0 && cell_area>0 && meq>=0)){
+      std::cerr<<"E Parameters must have neq, tol, dt, and cell_area positive and meq non-negative"<<std::endl;
+      return false;
+    }
+    if(!(threshold>=0 && hard_fraction>=0 && hard_fraction<=1 && hard_kfactor>0 && hard_neq>0)){
+      std::cerr<<"E Parameters must have threshold non-negative, hard_fraction in [0,1], and hard_kfactor and hard_neq positive"<<std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  ///Logs the parameters using the RichDEM machine-readable line prefixes
+  void print() const {
+    std::cout<<"m keq       = "<<keq      <<std::endl;
+    std::cout<<"m neq       = "<<neq      <<std::endl;
+    std::cout<<"m meq       = "<<meq      <<std::endl;
+    std::cout<<"m ueq       = "<<ueq      <<std::endl;
+    std::cout<<"m dt        = "<<dt       <<std::endl;
+    std::cout<<"m tol       = "<<tol      <<std::endl;
+    std::cout<<"m cell_area = "<<cell_area<<std::endl;
+    std::cout<<"m threshold     = "<<threshold    <<std::endl;
+    std::cout<<"m hard_fraction = "<<hard_fraction<<std::endl;
+    std::cout<<"m hard_kfactor  = "<<hard_kfactor <<std::endl;
+    std::cout<<"m hard_neq      = "<<hard_neq     <<std::endl;
+    std::cout<<"m boundary      = "<<boundary.name()<<std::endl;
+  }
+
+ private:
+  double *find(const std::string &name){
+    if(name=="keq"      ) return &keq;
+    if(name=="neq"      ) return &neq;
+    if(name=="meq"      ) return &meq;
+    if(name=="ueq"      ) return &ueq;
+    if(name=="dt"       ) return &dt;
+    if(name=="tol"      ) return &tol;
+    if(name=="cell_area") return &cell_area;
+    if(name=="threshold"    ) return &threshold;
+    if(name=="hard_fraction") return &hard_fraction;
+    if(name=="hard_kfactor" ) return &hard_kfactor;
+    if(name=="hard_neq"     ) return &hard_neq;
+    return nullptr;
+  }
+
+  static std::string Trim(const std::string &s){
+    const auto first = s.find_first_not_of(" \t\r");
+    if(first==std::string::npos)
+      return "";
+    const auto last = s.find_last_not_of(" \t\r");
+    return s.substr(first,last-first+1);
+  }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "ReceiverKernels.hpp"
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+//NOTE: It is tempting to multiply by a precomputed `1/dr[n]` rather than divide
+//by `dr[n]`. However, `x*(1/SQRT2)` and `x/SQRT2` may differ in their last bit,
+//which is enough to change which of two nearly-equal slopes is steepest. Since
+//we want the vectorized kernels to produce exactly the same receivers as the
+//scalar code, we keep the division. Vector division is pipelined on all
+//hardware with AVX2, so this costs little.
+
+template<class rec_t>
+void ComputeReceiversScalar(
+  const double *const h,
+  rec_t *const rec,
+  const int cstart,
+  const int cend,
+  const std::array<int,8> &nshift,
+  const double *const dr
+){
+  for(int c=cstart;c<cend;c++){
+    //The slope must be greater than zero for there to be downhill flow;
+    //otherwise, the cell is marked NO_FLOW.
+    double max_slope = 0;   //Maximum slope seen so far amongst neighbours
+    int    max_n     = -1;  //Direction of neighbour which had maximum slope to focal cell
+
+    //Loop over neighbours
+    for(int n=0;n<8;n++){
+      const double slope = (h[c] - h[c+nshift[n]])/dr[n]; //Slope to neighbour n
+      if(slope>max_slope){    //Is this the steepest slope we've seen?
+        max_slope = slope;    //If so, make a note of the slope
+        max_n     = n;        //And which cell it came from
+      }
+    }
+    rec[c] = static_cast<rec_t>(max_n); //Having considered all neighbours, this is the steepest
+  }
+}
+
+
+
+//The vectorized kernels process one cell per lane. Rather than branching on
+//`slope>max_slope`, each lane keeps its own running maximum and argmax, which
+//are updated with a mask-blend. Since directions are visited in the same order
+//and the comparison is the same strict greater-than, lanes break ties exactly
+//as the scalar kernel does. The argmax is carried as a vector of doubles so that
+//it can share the comparison mask without any lane-width conversion. Loads are
+//masked so that the leftover cells at the end of a run are processed by the
+//same vector code, rather than by the scalar kernel: runs can be short, such as
+//the rows of a tile (see GridLayout.hpp). The masked-off lanes read nothing and
+//their results are not stored.
+
+//Helpers which store a vector of 32-bit receiver directions to either an `int`
+//or an `int8_t` receiver array
+__attribute__((target("avx2")))
+static inline void StoreReceivers(int *const rec, const __m128i dirs){
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(rec),dirs);
+}
+
+__attribute__((target("avx2")))
+static inline void StoreReceivers(int8_t *const rec, const __m128i dirs){
+  const __m128i packed = _mm_packs_epi16(_mm_packs_epi32(dirs,dirs),dirs);
+  const int32_t lo = _mm_cvtsi128_si32(packed);
+  std::memcpy(rec,&lo,sizeof(lo));
+}
+
+__attribute__((target("avx512f")))
+static inline void StoreReceivers(int *const rec, const __m256i dirs){
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(rec),dirs);
+}
+
+__attribute__((target("avx512f")))
+static inline void StoreReceivers(int8_t *const rec, const __m256i dirs){
+  const __m128i lo16   = _mm_packs_epi32(_mm256_castsi256_si128(dirs),_mm256_extracti128_si256(dirs,1));
+  const __m128i packed = _mm_packs_epi16(lo16,lo16);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(rec),packed);
+}
+
+
+
+template<class rec_t>
+__attribute__((target("avx2")))
+void ComputeReceiversAVX2(
+  const double *const h,
+  rec_t *const rec,
+  const int cstart,
+  const int cend,
+  const std::array<int,8> &nshift,
+  const double *const dr
+){
+  __m256d vdr[8];
+  for(int n=0;n<8;n++)
+    vdr[n] = _mm256_set1_pd(dr[n]);
+
+  const __m256i lanes = _mm256_setr_epi64x(0,1,2,3);
+  for(int c=cstart;c<cend;c+=4){
+    const int     count = std::min(4,cend-c);
+    const __m256i live  = _mm256_cmpgt_epi64(_mm256_set1_epi64x(count),lanes);
+    const __m256d hc  = _mm256_maskload_pd(h+c,live);
+    __m256d max_slope = _mm256_setzero_pd();
+    __m256d max_n     = _mm256_set1_pd(-1);
+    for(int n=0;n<8;n++){
+      const __m256d slope   = _mm256_div_pd(_mm256_sub_pd(hc,_mm256_maskload_pd(h+c+nshift[n],live)),vdr[n]);
+      const __m256d steeper = _mm256_cmp_pd(slope,max_slope,_CMP_GT_OQ);
+      max_slope = _mm256_blendv_pd(max_slope,slope,steeper);
+      max_n     = _mm256_blendv_pd(max_n,_mm256_set1_pd(n),steeper);
+    }
+    if(count==4){
+      StoreReceivers(rec+c,_mm256_cvtpd_epi32(max_n));
+    } else {
+      int32_t dirs[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dirs),_mm256_cvtpd_epi32(max_n));
+      for(int l=0;l<count;l++)
+        rec[c+l] = static_cast<rec_t>(dirs[l]);
+    }
+  }
+}
+
+
+
+template<class rec_t>
+__attribute__((target("avx512f")))
+void ComputeReceiversAVX512(
+  const double *const h,
+  rec_t *const rec,
+  const int cstart,
+  const int cend,
+  const std::array<int,8> &nshift,
+  const double *const dr
+){
+  __m512d vdr[8];
+  for(int n=0;n<8;n++)
+    vdr[n] = _mm512_set1_pd(dr[n]);
+
+  for(int c=cstart;c<cend;c+=8){
+    const int      count = std::min(8,cend-c);
+    const __mmask8 live  = static_cast<__mmask8>((1u<<count)-1);
+    const __m512d hc  = _mm512_maskz_loadu_pd(live,h+c);
+    __m512d max_slope = _mm512_setzero_pd();
+    __m512d max_n     = _mm512_set1_pd(-1);
+    for(int n=0;n<8;n++){
+      const __m512d slope   = _mm512_div_pd(_mm512_sub_pd(hc,_mm512_maskz_loadu_pd(live,h+c+nshift[n])),vdr[n]);
+      const __mmask8 steeper = _mm512_cmp_pd_mask(slope,max_slope,_CMP_GT_OQ);
+      max_slope = _mm512_mask_blend_pd(steeper,max_slope,slope);
+      max_n     = _mm512_mask_blend_pd(steeper,max_n,_mm512_set1_pd(n));
+    }
+    //The masked conversion is equivalent to `_mm512_cvtpd_epi32()` but avoids a
+    //spurious -Wmaybe-uninitialized warning from some versions of GCC's headers
+    const __m256i dirs = _mm512_mask_cvtpd_epi32(_mm256_setzero_si256(),0xFF,max_n);
+    if(count==8){
+      StoreReceivers(rec+c,dirs);
+    } else {
+      int32_t part[8];
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(part),dirs);
+      for(int l=0;l<count;l++)
+        rec[c+l] = static_cast<rec_t>(part[l]);
+    }
+  }
+}
+
+
+
+template<class rec_t>
+ReceiverKernelT<rec_t> SelectReceiverKernel(){
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    return ComputeReceiversAVX512<rec_t>;
+  else if(__builtin_cpu_supports("avx2"))
+    return ComputeReceiversAVX2<rec_t>;
+  else
+    return ComputeReceiversScalar<rec_t>;
+}
+
+
+
+template<class rec_t>
+std::string ReceiverKernelName(const ReceiverKernelT<rec_t> kernel){
+  if(kernel==ComputeReceiversAVX512<rec_t>)
+    return "avx512";
+  else if(kernel==ComputeReceiversAVX2<rec_t>)
+    return "avx2";
+  else
+    return "scalar";
+}
+
+
+
+template void ComputeReceiversScalar<int   >(const double *const h, int    *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template void ComputeReceiversScalar<int8_t>(const double *const h, int8_t *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template void ComputeReceiversAVX2  <int   >(const double *const h, int    *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template void ComputeReceiversAVX2  <int8_t>(const double *const h, int8_t *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template void ComputeReceiversAVX512<int   >(const double *const h, int    *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template void ComputeReceiversAVX512<int8_t>(const double *const h, int8_t *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template ReceiverKernelT<int>    SelectReceiverKernel<int   >();
+template ReceiverKernelT<int8_t> SelectReceiverKernel<int8_t>();
+template std::string ReceiverKernelName<int   >(const ReceiverKernelT<int>    kernel);
+template std::string ReceiverKernelName<int8_t>(const ReceiverKernelT<int8_t> kernel);
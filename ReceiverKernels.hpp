@@ -0,0 +1,49 @@
+//This file contains kernels which determine the receiver (the steepest downhill
+//neighbour) of each cell in a contiguous run of cells from a single row. A
+//scalar kernel is always available. Explicitly vectorized AVX2 and AVX-512
+//kernels are compiled alongside it and the fastest kernel the CPU supports is
+//chosen at runtime, so a binary built on one machine still runs on another.
+#ifndef _receiver_kernels_hpp_
+#define _receiver_kernels_hpp_
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+///All receiver kernels share this signature. A kernel considers the cells
+///`cstart` through `cend-1`, which must all lie in a single row of the DEM and
+///be at least one cell away from its edge. More generally, they must be
+///contiguous in memory and all find their neighbours at the offsets `nshift`
+///(see GridLayout.hpp). For each cell it writes to `rec` the
+///direction (0-7, see `nshift`) of the neighbour with the steepest downhill
+///slope or -1 (NO_FLOW) if no neighbour is lower. Ties go to the lowest
+///direction, so all kernels produce bit-identical `rec` arrays. Kernels are
+///available for `int` and `int8_t` receiver arrays. A caller whose indices do
+///not fit in an int passes `h` and `rec` offset to the start of the run.
+template<class rec_t>
+using ReceiverKernelT = void (*)(
+  const double *const h,
+  rec_t *const rec,
+  const int cstart,
+  const int cend,
+  const std::array<int,8> &nshift,
+  const double *const dr
+);
+typedef ReceiverKernelT<int> ReceiverKernel;
+
+//The target attributes must appear on these declarations as well as on the
+//definitions: GCC ignores them on the definition of a template which has
+//already been declared without them.
+template<class rec_t>                                     void ComputeReceiversScalar(const double *const h, rec_t *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template<class rec_t> __attribute__((target("avx2"   ))) void ComputeReceiversAVX2  (const double *const h, rec_t *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+template<class rec_t> __attribute__((target("avx512f"))) void ComputeReceiversAVX512(const double *const h, rec_t *const rec, const int cstart, const int cend, const std::array<int,8> &nshift, const double *const dr);
+
+///Returns the fastest receiver kernel supported by the CPU we are running on
+template<class rec_t=int>
+ReceiverKernelT<rec_t> SelectReceiverKernel();
+
+///Returns a short, human-readable name for a kernel (used for logging)
+template<class rec_t>
+std::string ReceiverKernelName(const ReceiverKernelT<rec_t> kernel);
+
+#endif
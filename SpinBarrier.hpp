@@ -0,0 +1,54 @@
+//This file contains a lightweight barrier for threads which are already running
+//together, such as the members of an OpenMP team. It is meant for separating
+//many short phases of work, where an OpenMP barrier or the fork/join of a new
+//parallel region would cost more than the work itself.
+#ifndef _spin_barrier_hpp_
+#define _spin_barrier_hpp_
+
+#include <atomic>
+#include <thread>
+
+///A sense-reversing barrier. Each thread keeps its own `sense`, initially
+///false, and passes it to every call of wait(). The last thread to arrive
+///resets the count and flips the shared sense, releasing the others, which have
+///been spinning on it. Because the shared sense alternates, the barrier can be
+///reused immediately without a second round of synchronization.
+class SpinBarrier {
+ private:
+  std::atomic<int>  count{0};     //Threads yet to arrive in the current phase
+  std::atomic<bool> sense{false}; //Flipped each time all threads have arrived
+  int nthreads = 0;               //Number of threads which must arrive
+
+  //A thread which has spun this many times without being released yields its
+  //processor, in case there are more threads than processors
+  static constexpr int SPINS_BEFORE_YIELD = 1<<12;
+
+ public:
+  ///Sets the number of threads which will use the barrier. Must not be called
+  ///while any thread is waiting.
+  void reset(const int nthreads0){
+    nthreads = nthreads0;
+    count.store(nthreads0, std::memory_order_relaxed);
+    sense.store(false,     std::memory_order_relaxed);
+  }
+
+  ///Blocks until all threads have called wait(). `local_sense` is the calling
+  ///thread's own sense.
+  void wait(bool &local_sense){
+    local_sense = !local_sense;
+    if(count.fetch_sub(1, std::memory_order_acq_rel)==1){
+      count.store(nthreads, std::memory_order_relaxed);
+      sense.store(local_sense, std::memory_order_release);
+    } else {
+      int spins = 0;
+      while(sense.load(std::memory_order_acquire)!=local_sense){
+        if(++spins==SPINS_BEFORE_YIELD){
+          std::this_thread::yield();
+          spins = 0;
+        }
+      }
+    }
+  }
+};
+
+#endif
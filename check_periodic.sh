@@ -0,0 +1,38 @@
+#!/bin/bash
+
+#With periodic east and west edges no column of the DEM is special, so moving
+#the initial terrain east by some number of columns should move the output by
+#the same amount and change nothing else. This runs fastscape_RB+PT with and
+#without its --roll option for each periodic boundary and checks that the
+#outputs match cell for cell once the shift is undone.
+
+size=101
+steps=120
+shift=37
+
+status=0
+for boundary in OPOP NPNP OPNP; do
+  ./fastscape_RB+PT.exe $size $steps out_periodic_${boundary}_0.dem      123 --boundary $boundary                 > /dev/null || status=1
+  ./fastscape_RB+PT.exe $size $steps out_periodic_${boundary}_$shift.dem 123 --boundary $boundary --roll $shift > /dev/null || status=1
+
+  #The saved DEM omits the halo, so its first and last columns are the ring
+  #and the eroding columns lie between them
+  awk -v shift=$shift -v boundary=$boundary '
+    FNR<=6      { next }
+    FNR==NR     { for(i=1;i<=NF;i++) a[FNR,i]=$i; next }
+                {
+                  ncols = NF-2
+                  for(i=0;i<ncols;i++){
+                    if(a[FNR,i+2]!=$((i+shift)%ncols+2)) differ++
+                    cells++
+                  }
+                  if($1!=0 || $NF!=0) differ++
+                }
+    END         {
+                  print boundary": "differ+0" of "cells" cells differ"
+                  exit (differ>0 || cells==0)
+                }
+  ' out_periodic_${boundary}_0.dem out_periodic_${boundary}_$shift.dem || status=1
+done
+
+exit $status
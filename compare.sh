@@ -4,20 +4,61 @@ rm -rf out_*.dem*
 
 ./fastscape_BW.exe     501 120 out_BW.dem     123
 ./fastscape_BW+P.exe   501 120 out_BW+P.dem   123
+./fastscape_BW+P.exe   501 120 out_BW+P_subtree.dem 123 --subtree-flowacc
 ./fastscape_BW+PI.exe  501 120 out_BW+PI.dem  123
 ./fastscape_RB.exe     501 120 out_RB.dem     123
 ./fastscape_RB+P.exe   501 120 out_RB+P.dem   123
 ./fastscape_RB+PI.exe  501 120 out_RB+PI.dem  123
 ./fastscape_RB+PQ.exe  501 120 out_RB+PQ.dem  123
+./fastscape_RB+PC.exe  501 120 out_RB+PC.dem  123
+./fastscape_RB+PT.exe  501 120 out_RB+PT.dem  123
+./fastscape_RB+PT.exe  501 120 out_RB+PT_mixed.dem 123 --mixed --accuracy
+./fastscape_RB+PT.exe  501 120 out_RB+PT_float.dem 123 --float --accuracy
 ./fastscape_RB+GPU.exe 501 120 out_RB+GPU.dem 123
+#With n=1 these parameters wear the landscape almost flat, where rounding
+#differences flip receivers within a few steps, so these runs are short. RB+PI
+#erodes them by pointer jumping, and by a sweep down the stack in its persistent
+#mode, as RB+PT does.
+./fastscape_RB+PI.exe  501 5   out_RB+PI_n1.dem 123 --neq 1
+./fastscape_RB+PI.exe  501 5   out_RB+PI_n1_sweep.dem 123 --neq 1 --persistent
+./fastscape_RB+PT.exe  501 5   out_RB+PT_n1.dem 123 --neq 1
+#n=1.5 has no closed form: RB+PI and RB+PQ solve it by Newton's method in SIMD
+#batches, RB+PI's persistent mode and RB+PT one cell at a time. The batches
+#round the powers differently, which receiver flips amplify over long runs.
+./fastscape_RB+PI.exe  501 10  out_RB+PI_n15.dem 123 --neq 1.5
+./fastscape_RB+PQ.exe  501 10  out_RB+PQ_n15.dem 123 --neq 1.5
+./fastscape_RB+PI.exe  501 10  out_RB+PI_n15_cells.dem 123 --neq 1.5 --persistent
+./fastscape_RB+PT.exe  501 10  out_RB+PT_n15.dem 123 --neq 1.5
+#Newton-Raphson iteration in place of the closed form for n=2: RB+PI iterates
+#in its own loop, RB+PT through an erosion law without a closed form
+./fastscape_RB+PI.exe  501 120 out_RB+PI_newton.dem 123 --newton
+./fastscape_RB+PT.exe  501 120 out_RB+PT_newton.dem 123 --newton
+#A closed domain, in which every cell may be left without a receiver, run in
+#both grid layouts
+./fastscape_RB+PT.exe  101 400 out_RB+PT_closed.dem     123 --boundary NNNN --neq 1
+./fastscape_RB+PT.exe  101 400 out_RB+PT_closed_row.dem 123 --boundary NNNN --neq 1 --row-major
 
 #This script uses `rd_compare` from the RichDEM library.
 #Obtain it with `pip3 install richdem` or use your own comparison tools.
 rd_compare out_BW.dem out_BW.dem    
 rd_compare out_BW.dem out_BW+P.dem  
+rd_compare out_BW.dem out_BW+P_subtree.dem
 rd_compare out_BW.dem out_BW+PI.dem  
 rd_compare out_BW.dem out_RB.dem    
 rd_compare out_BW.dem out_RB+P.dem  
 rd_compare out_BW.dem out_RB+PI.dem  
 rd_compare out_BW.dem out_RB+PQ.dem 
+rd_compare out_BW.dem out_RB+PC.dem 
+rd_compare out_BW.dem out_RB+PT.dem 
+#Reduced-precision runs are not expected to match exactly. Their own accuracy
+#reports above are finer than the precision of the saved DEMs.
+rd_compare out_BW.dem out_RB+PT_mixed.dem 
+rd_compare out_BW.dem out_RB+PT_float.dem 
 rd_compare out_BW.dem out_RB+GPU.dem 
+rd_compare out_RB+PI_n1_sweep.dem out_RB+PI_n1.dem
+rd_compare out_RB+PI_n15_cells.dem out_RB+PI_n15.dem
+rd_compare out_RB+PI_n15_cells.dem out_RB+PQ_n15.dem
+rd_compare out_RB+PT_n1.dem out_RB+PI_n1.dem
+rd_compare out_RB+PT_n15.dem out_RB+PI_n15.dem
+rd_compare out_RB+PT_newton.dem out_RB+PI_newton.dem
+rd_compare out_RB+PT_closed.dem out_RB+PT_closed_row.dem
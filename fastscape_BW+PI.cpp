@@ -1,17 +1,23 @@
 //This file contains a serial implementation of Braun and Willett's FastScape
 //algorithm. The implementation was developed by adapting Fortran code provided
 //by Braun and attempts to be a faithful reproduction of the ideas therein.
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <fenv.h> //Used to catch floating point NaN issues
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <omp.h>  //Used for OpenMP run-time functions
 #include "random.hpp"
 #include <vector>
 #include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ReceiverKernels.hpp"
 
 
 
@@ -63,7 +69,7 @@ class FastScape_BWPF {
   const double ueq       = 2e-3;   //Rate of uplift
   const double dt        = 1000.;  //Timestep interval
   const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
-  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler
+  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
   const double cell_area = 40000;  //Area of a single cell
 
 
@@ -85,15 +91,42 @@ class FastScape_BWPF {
 
   std::vector<double> h;        //Digital elevation model (height)
   std::vector<double> accum;    //Flow accumulation at each point
+  std::vector<double> efact;    //Prefactor of the implicit erosion equation at each cell (see ComputeErosionFactors())
+  double              inv_drn[8]; //1/dr^n for each direction
   std::vector<int>    rec;      //Direction of receiving cell
   std::vector<int>    donor;    //Indices of a cell's donor cells
   std::vector<int>    ndon;     //How many donors a cell has
   std::vector<int>    stack;    //Indices of cells in the order they should be processed
   std::array<int,8>   nshift;   //Offset from a focal cell's index to its neighbours in terms of flat indexing
+  ReceiverKernel      receiver_kernel; //Kernel used to find the receivers of a row of cells
 
   //Indicates where each tree of the stack begins
   std::vector<int>    stack_start;
 
+  //Used for building the stack in parallel (see GenerateOrder())
+  std::vector<int>              roots;        //NO_FLOW cells, each of which is the root of a tree
+  std::vector<int>              basin_size;   //Number of cells in each tree
+  std::vector<int>              basin_thread; //Thread which built each tree
+  std::vector<int>              basin_offset; //Where each tree starts in its thread's buffer
+  std::vector<std::vector<int>> stack_buf;    //Each thread's trees
+  std::vector<std::vector<int>> todo_buf;     //Each thread's cells still to be visited (see FindStack())
+
+  //Used for dividing the trees amongst threads (see ScheduleBasins())
+  int                 big_basin_cells = 10000; //Trees at least this large may be processed level by level
+  int                 chunk_cells     = 4096;  //Small trees are grouped into chunks of at least this many cells
+  std::vector<int>    depth;        //Level of each cell within its tree (see FindStack())
+  std::vector<int>    big_basins;   //Trees processed level by level
+  std::vector<int>    big_cells;    //Cells of the big trees, ordered by level
+  std::vector<int>    big_levels;   //Where each level begins in `big_cells`
+  std::vector<std::vector<int>> level_count; //Each thread's cells of the big trees in each level (see OrderBigCells())
+  std::vector<int>    small_basins; //The remaining trees, largest first
+  std::vector<int>    chunk_start;  //Where each chunk begins in `small_basins`
+  std::vector<double> thread_busy;  //Seconds each thread spent working in the current step
+  double erosion_imbalance;         //Over the run, seconds the busiest thread worked beyond the average in Erode()
+  double erosion_ratio = 1;         //In the current step, ratio of the busiest thread's work to the average in Erode()
+  double flowacc_imbalance;         //As above, for ComputeFlowAcc()
+  double flowacc_ratio = 1;
+
   //Timers for keeping track of how long each part of the code takes
   CumulativeTimer Tmr_Step1_Initialize;
   CumulativeTimer Tmr_Step2_DetermineReceivers;
@@ -149,6 +182,8 @@ class FastScape_BWPF {
 
     h.resize(size);   //Memory for terrain height
 
+    receiver_kernel = SelectReceiverKernel(); //Fastest kernel this CPU supports
+
     GenerateRandomTerrain();     //Could replace this with custom initializer
 
     Tmr_Step1_Initialize.stop();
@@ -165,25 +200,11 @@ class FastScape_BWPF {
   void ComputeReceivers(){
     //Edge cells do not have receivers because they do not distribute their flow
     //to anywhere.
+
+    //Each row of interior cells is handed to the receiver kernel chosen when
+    //the model was constructed (see ReceiverKernels.hpp).
     for(int y=2;y<height-2;y++)
-    for(int x=2;x<width-2;x++){
-      const int c      = y*width+x;
-
-      //The slope must be greater than zero for there to be downhill flow;
-      //otherwise, the cell is marked NO_FLOW.
-      double max_slope = 0;        //Maximum slope seen so far amongst neighbours
-      int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
-
-      //Loop over neighbours
-      for(int n=0;n<8;n++){
-        const double slope = (h[c] - h[c+nshift[n]])/dr[n]; //Slope to neighbour n
-        if(slope>max_slope){    //Is this the steepest slope we've seen?
-          max_slope = slope;    //If so, make a note of the slope
-          max_n     = n;        //And which cell it came from
-        }
-      }
-      rec[c] = max_n;           //Having considered all neighbours, this is the steepest
-    }   
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
   }
 
 
@@ -217,35 +238,232 @@ class FastScape_BWPF {
   }
 
 
-  void FindStack(const int c, int &nstack){
-    for(int k=0;k<ndon[c];k++){
-      const auto n    = donor[8*c+k];
-      stack[nstack++] = n;
-      FindStack(n,nstack);
+  ///Appends the cells of the tree rooted at `c` to `buf` in depth-first
+  ///pre-order: each cell comes before all of its donors. Long, sinuous rivers
+  ///make for very deep trees, so rather than recursing we keep the cells still
+  ///to be visited in `todo`. Donors are pushed in reverse so that they are
+  ///visited in the same order as a recursive search would visit them.
+  ///
+  ///If FIND_DEPTH, each cell's level within the tree, one more than its
+  ///receiver's, is recorded in `depth` for ScheduleBasins(). Finding it here,
+  ///while the trees are built in parallel, spares a serial pass over the largest
+  ///trees later.
+  template<bool FIND_DEPTH>
+  void FindStack(const int c, std::vector<int> &buf, std::vector<int> &todo){
+    if(FIND_DEPTH)
+      depth[c] = 0;
+    todo.push_back(c);
+    while(!todo.empty()){
+      const int x = todo.back();
+      todo.pop_back();
+      buf.push_back(x);
+      for(int k=ndon[x]-1;k>=0;k--){
+        const int d = donor[8*x+k];
+        if(FIND_DEPTH)
+          depth[d] = depth[x]+1;
+        todo.push_back(d);
+      }
     }
-  }  
+  }
 
 
   ///Cells must be ordered so that they can be traversed such that higher cells
   ///are processed before their lower neighbouring cells. This method creates
   ///such an order.
   void GenerateOrder(){
-    //The `stack_start` array has an unpredictable size, so we fill it
-    //dynamically and reset it each time. This should have minimal impact on the
-    //algorithm's speed since std::vector's memory is not actually reallocated.    
-    stack_start.clear();
-
-    int nstack=0;
-    for(int c=0;c<size;c++){
-      if(rec[c]==NO_FLOW){
-        stack_start.push_back(nstack);
-        stack[nstack++] = c;
-        FindStack(c,nstack);
+    //Each NO_FLOW cell is the root of a tree
+    roots.clear();
+    for(int c=0;c<size;c++)
+      if(rec[c]==NO_FLOW)
+        roots.push_back(c);
+
+    const int nroots = roots.size();
+    basin_size  .resize(nroots);
+    basin_thread.resize(nroots);
+    basin_offset.resize(nroots);
+    stack_start .resize(nroots+1);
+
+    //Levels are only used for trees which ScheduleBasins() has all threads
+    //process together, of which there are none with a single thread
+    const bool find_depth = omp_get_max_threads()>1;
+
+    #pragma omp parallel
+    {
+      const int tid = omp_get_thread_num();
+      auto &buf     = stack_buf[tid];
+      buf.clear();
+
+      //Trees vary greatly in size, so they are handed out dynamically. Each
+      //thread builds its trees one after another in its own buffer and notes
+      //where each one is.
+      #pragma omp for schedule(dynamic,16)
+      for(int r=0;r<nroots;r++){
+        basin_thread[r] = tid;
+        basin_offset[r] = buf.size();
+        if(find_depth)
+          FindStack<true >(roots[r],buf,todo_buf[tid]);
+        else
+          FindStack<false>(roots[r],buf,todo_buf[tid]);
+        basin_size[r]   = buf.size()-basin_offset[r];
       }
-    }  
-    //We add an additional note to the end of `stack_start` that serves as an
-    //upper bound on the locations of the cells in the final stack. See b    
-    stack_start.push_back(nstack);
+
+      //The trees are placed in the global stack in the order of their roots.
+      //The final entry of `stack_start` serves as an upper bound on the
+      //locations of the cells in the stack.
+      #pragma omp single
+      {
+        stack_start[0] = 0;
+        for(int r=0;r<nroots;r++)
+          stack_start[r+1] = stack_start[r]+basin_size[r];
+      }
+
+      #pragma omp for schedule(dynamic,16)
+      for(int r=0;r<nroots;r++){
+        const auto src = stack_buf[basin_thread[r]].begin()+basin_offset[r];
+        std::copy(src, src+basin_size[r], stack.begin()+stack_start[r]);
+      }
+    }
+
+    ScheduleBasins();
+  }
+
+
+
+  ///Plans how the trees of the stack are divided amongst threads in
+  ///ComputeFlowAcc() and Erode(). Scheduling one tree at a time works poorly:
+  ///a single tree spanning much of the DEM leaves the other threads idle, and
+  ///thousands of single-cell trees each pay a scheduling cost. So, trees larger
+  ///than a thread's fair share of the DEM are instead processed together, level
+  ///by level, with all threads working on each level. The remaining trees are
+  ///sorted from largest to smallest and grouped into chunks of at least
+  ///`chunk_cells` cells, which are handed out dynamically, largest first.
+  void ScheduleBasins(){
+    const int nbasins  = stack_start.size()-1;
+    const int nthreads = omp_get_max_threads();
+
+    //Divide the trees into big and small
+    small_basins.clear();
+    big_basins.clear();
+    int nbig = 0;
+    for(int b=0;b<nbasins;b++){
+      const int bsize = stack_start[b+1]-stack_start[b];
+      if(nthreads>1 && bsize>=big_basin_cells && static_cast<int64_t>(bsize)*nthreads>size){
+        big_basins.push_back(b);
+        nbig += bsize;
+      } else {
+        small_basins.push_back(b);
+      }
+    }
+
+    OrderBigCells(nbig);
+
+    //Order the small trees largest first and chunk them
+    std::sort(small_basins.begin(), small_basins.end(), [&](const int a, const int b){
+      return stack_start[a+1]-stack_start[a] > stack_start[b+1]-stack_start[b];
+    });
+    chunk_start.clear();
+    int chunk_size = chunk_cells;
+    for(unsigned int i=0;i<small_basins.size();i++){
+      if(chunk_size>=chunk_cells){
+        chunk_start.push_back(i);
+        chunk_size = 0;
+      }
+      const int b = small_basins[i];
+      chunk_size += stack_start[b+1]-stack_start[b];
+    }
+    chunk_start.push_back(small_basins.size());
+  }
+
+
+
+  ///Gathers the `nbig` cells of the big trees into `big_cells`, ordered by
+  ///level, and marks where each level begins in `big_levels`. FindStack() has
+  ///already found each cell's level. Each thread counts the cells of each level
+  ///in an equal share of the big trees. From the counts, each thread knows where
+  ///its cells of each level go, so all threads place their cells at once.
+  ///Within a level, the cells keep their order in the stack.
+  void OrderBigCells(const int nbig){
+    big_cells.resize(nbig);
+    big_levels.clear();
+    if(big_basins.empty())
+      return;
+
+    #pragma omp parallel
+    {
+      const int tid      = omp_get_thread_num();
+      const int nthreads = omp_get_num_threads();
+      const int first    = static_cast<int64_t>(nbig)*tid    /nthreads;
+      const int last     = static_cast<int64_t>(nbig)*(tid+1)/nthreads;
+      auto &count        = level_count[tid];
+
+      count.clear();
+      ForBigCells(first, last, [&](const int c){
+        if(depth[c]>=static_cast<int>(count.size()))
+          count.resize(depth[c]+1,0);
+        count[depth[c]]++;
+      });
+
+      //Replace each count with where the thread's cells of that level begin
+      #pragma omp barrier
+      #pragma omp single
+      {
+        int nlevels = 0;
+        for(int t=0;t<nthreads;t++)
+          nlevels = std::max(nlevels, static_cast<int>(level_count[t].size()));
+        big_levels.assign(nlevels+1,0);
+        int start = 0;
+        for(int li=0;li<nlevels;li++){
+          for(int t=0;t<nthreads;t++){
+            if(li>=static_cast<int>(level_count[t].size()))
+              continue;
+            const int n = level_count[t][li];
+            level_count[t][li] = start;
+            start += n;
+          }
+          big_levels[li+1] = start;
+        }
+      }
+
+      ForBigCells(first, last, [&](const int c){
+        big_cells[count[depth[c]]++] = c;
+      });
+    }
+  }
+
+
+
+  ///Calls `f` on each of the cells of the big trees numbered from `first` to
+  ///`last`, counting through the trees in turn in stack order
+  template<class F>
+  void ForBigCells(const int first, const int last, F f) const {
+    int offset = 0; //Number of cells in the big trees before tree b
+    for(const auto b: big_basins){
+      const int bstart = stack_start[b];
+      const int bsize  = stack_start[b+1]-bstart;
+      const int lo     = std::max(first-offset,0);
+      const int hi     = std::min(last -offset,bsize);
+      for(int i=lo;i<hi;i++)
+        f(stack[bstart+i]);
+      offset += bsize;
+    }
+  }
+
+
+
+  ///Returns how much longer the busiest thread spent working than the average
+  ///thread, according to `thread_busy`, and zeros `thread_busy`. The ratio of
+  ///the busiest to the average thread is stored in `ratio`.
+  double Imbalance(double &ratio){
+    double max = 0;
+    double sum = 0;
+    for(auto &t: thread_busy){
+      max  = std::max(max,t);
+      sum += t;
+      t    = 0;
+    }
+    const double mean = sum/thread_busy.size();
+    ratio = (mean>0) ? max/mean : 1;
+    return max-mean;
   }
 
 
@@ -258,20 +476,45 @@ class FastScape_BWPF {
     //Highly-elevated cells pass their flow to less elevated neighbour cells.
     //The stack is ordered so that higher cells are keyed to higher indices in
     //the stack; therefore, parsing the stack in reverse ensures that fluid
-    //flows downhill.
-    #pragma omp parallel for schedule(dynamic)
-    for(unsigned int ss=0;ss<stack_start.size()-1;ss++){
-      const int sstart = stack_start.at(ss);
-      const int send   = stack_start.at(ss+1);
-      for(int s=send-1;s>=sstart;s--){
-        const int c = stack[s];
-        if(rec[c]!=NO_FLOW){
-          const int n = c+nshift[rec[c]];
-          accum[n]   += accum[c];
+    //flows downhill. See ScheduleBasins() for how the work is divided.
+    #pragma omp parallel
+    {
+      const int tid = omp_get_thread_num();
+
+      //Big trees, from the top level down. Several cells in a level may pass
+      //their flow to the same cell, so each cell instead gathers the flow of
+      //its donors, which lie in the level above.
+      for(int li=static_cast<int>(big_levels.size())-2;li>=0;li--){
+        const double t0 = omp_get_wtime();
+        #pragma omp for schedule(static) nowait
+        for(int i=big_levels[li];i<big_levels[li+1];i++){
+          const int c = big_cells[i];
+          for(int k=0;k<ndon[c];k++)
+            accum[c] += accum[donor[8*c+k]];
+        }
+        thread_busy[tid] += omp_get_wtime()-t0;
+        #pragma omp barrier
+      }
+
+      //Small trees, in chunks
+      const double t0 = omp_get_wtime();
+      #pragma omp for schedule(dynamic) nowait
+      for(unsigned int k=0;k<chunk_start.size()-1;k++)
+      for(int i=chunk_start[k];i<chunk_start[k+1];i++){
+        const int b = small_basins[i];
+        for(int s=stack_start[b+1]-1;s>=stack_start[b];s--){
+          const int c = stack[s];
+          if(rec[c]!=NO_FLOW){
+            const int n = c+nshift[rec[c]];
+            accum[n]   += accum[c];
+          }
         }
       }
-    }   
-  } 
+      thread_busy[tid] += omp_get_wtime()-t0;
+    }
+
+    flowacc_imbalance += Imbalance(flowacc_ratio);
+  }
 
 
 
@@ -293,6 +536,33 @@ class FastScape_BWPF {
 
 
 
+  ///Erodes a single cell. See Erode().
+  void ErodeCell(const int c){
+    const int n = c+nshift[rec[c]];  //Cell receiving the flow
+
+    const double fact   = efact[c];
+    const double h0     = h[c];      //Elevation of focal cell
+    const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
+    h[c] = ErodeCellImplicit(h0, hn, fact, neq, tol); //Update value in array (see ErosionKernels.hpp)
+  }
+
+
+
+  ///Fills `efact` with the prefactor K*dt*A^m/L^n of the implicit erosion
+  ///equation of every cell (see ErosionKernels.hpp). It depends only on the
+  ///flow accumulation and the receivers, so rather than being found cell by
+  ///cell during erosion it is computed for the whole DEM in one pass, which
+  ///vectorizes because PowPositive() stands in for std::pow and `inv_drn` for
+  ///the division. The value for a cell without a receiver is never used.
+  void ComputeErosionFactors(){
+    const double kdt = keq*dt;
+    #pragma omp parallel for simd
+    for(int c=0;c<size;c++)
+      efact[c] = kdt*PowPositive(accum[c],meq)*inv_drn[rec[c]&7];
+  }
+
+
+
   ///Decrease he height of cells according to the stream power equation; that
   ///is, based on a constant K, flow accumulation A, the local slope between
   ///the cell and its receiving neighbour, and some judiciously-chosen constants
@@ -300,31 +570,41 @@ class FastScape_BWPF {
   ///    h_next = h_current - K*dt*(A^m)*(Slope)^n
   ///We solve this equation implicitly to preserve accuracy
   void Erode(){
-    #pragma omp parallel for schedule(dynamic)
-    for(unsigned int ss=0;ss<stack_start.size()-1;ss++){
-      const int sstart = stack_start.at(ss);
-      const int send   = stack_start.at(ss+1);
-      for(int s=sstart;s<send;s++){
-        const int c = stack[s];           //Cell from which flow originates
-        if(rec[c]==NO_FLOW)
-          continue;
-        const int n = c+nshift[rec[c]];   //Cell receiving the flow
-
-        const double length = dr[rec[c]];
-        const double fact   = keq*dt*std::pow(accum[c],meq)/std::pow(length,neq);
-        const double h0     = h[c];      //Elevation of focal cell
-        const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
-        double hnew         = h0;        //Current updated value of focal cell
-        double hp           = h0;        //Previous updated value of focal cell
-        double diff         = 2*tol;     //Difference between current and previous updated values
-        while(std::abs(diff)>tol){       //Newton-Rhapson method (run until subsequent values differ by less than a tolerance, which can be set to any desired precision)
-          hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
-          diff  = hnew - hp;             //Difference between previous and current value of the iteration
-          hp    = hnew;                  //Update previous value to new value
+    ComputeErosionFactors();
+
+    //See ScheduleBasins() for how the work is divided
+    #pragma omp parallel
+    {
+      const int tid = omp_get_thread_num();
+
+      //Big trees, level by level. Level 0 contains the NO_FLOW cells, so we
+      //skip it. The work is timed separately from the barrier so that time
+      //spent waiting counts as idle.
+      for(unsigned int li=1;li+1<big_levels.size();li++){
+        const double t0 = omp_get_wtime();
+        #pragma omp for schedule(static) nowait
+        for(int i=big_levels[li];i<big_levels[li+1];i++)
+          ErodeCell(big_cells[i]);
+        thread_busy[tid] += omp_get_wtime()-t0;
+        #pragma omp barrier
+      }
+
+      //Small trees, in chunks
+      const double t0 = omp_get_wtime();
+      #pragma omp for schedule(dynamic) nowait
+      for(unsigned int k=0;k<chunk_start.size()-1;k++)
+      for(int i=chunk_start[k];i<chunk_start[k+1];i++){
+        const int b = small_basins[i];
+        for(int s=stack_start[b];s<stack_start[b+1];s++){
+          const int c = stack[s];          //Cell from which flow originates
+          if(rec[c]!=NO_FLOW)
+            ErodeCell(c);
         }
-        h[c] = hnew;                     //Update value in array
       }
+      thread_busy[tid] += omp_get_wtime()-t0;
     }
+
+    erosion_imbalance += Imbalance(erosion_ratio);
   }
 
 
@@ -343,15 +623,30 @@ class FastScape_BWPF {
     Tmr_Step1_Initialize.start();
 
     accum.resize(  size);  //Stores flow accumulation
+    efact.resize(  size);  //Stores the erosion prefactors
     rec.resize  (  size);  //Array of Receiver directions
     ndon.resize (  size);  //Number of donors each cell has
     donor.resize(8*size);  //Array listing the donors of each cell (up to 8 for a rectangular grid)
     stack.resize(  size);  //Order in which to process cells
+    stack_buf.resize(omp_get_max_threads());
+    todo_buf .resize(omp_get_max_threads());
+    depth.resize(size);
+    level_count.resize(omp_get_max_threads());
+    thread_busy.assign(omp_get_max_threads(), 0);
+    erosion_imbalance = 0;
+    flowacc_imbalance = 0;
 
     ///All receivers initially point to nowhere
     for(int i=0;i<size;i++)
       rec[i] = NO_FLOW;
 
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
     Tmr_Step1_Initialize.stop();
 
     for(int step=0;step<=nstep;step++){
@@ -362,12 +657,16 @@ class FastScape_BWPF {
       Tmr_Step6_Uplift.start             ();   AddUplift         (); Tmr_Step6_Uplift.stop             ();
       Tmr_Step7_Erosion.start            ();   Erode             (); Tmr_Step7_Erosion.stop            ();
 
-      if( step%20==0 ) //Show progress
+      if( step%20==0 ){ //Show progress
         std::cout<<"p Step = "<<step<<std::endl;
+        std::cout<<"m Busiest/average thread: flow accumulation = "<<flowacc_ratio<<"; erosion = "<<erosion_ratio<<std::endl;
+      }
     }
 
     Tmr_Overall.stop();
 
+    std::cout<<"m Receiver kernel = "<<ReceiverKernelName(receiver_kernel)<<std::endl;
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
     std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
     std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
     std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
@@ -375,16 +674,24 @@ class FastScape_BWPF {
     std::cout<<"t Step5: FlowAcc            = "<<std::setw(15)<<Tmr_Step5_FlowAcc.elapsed()            <<" microseconds"<<std::endl;              
     std::cout<<"t Step6: Uplift             = "<<std::setw(15)<<Tmr_Step6_Uplift.elapsed()             <<" microseconds"<<std::endl;             
     std::cout<<"t Step7: Erosion            = "<<std::setw(15)<<Tmr_Step7_Erosion.elapsed()            <<" microseconds"<<std::endl;              
+    std::cout<<"t Step5: FlowAcc imbalance  = "<<std::setw(15)<<static_cast<uint64_t>(1e6*flowacc_imbalance)<<" microseconds"<<std::endl;
+    std::cout<<"t Step7: Erosion imbalance  = "<<std::setw(15)<<static_cast<uint64_t>(1e6*erosion_imbalance)<<" microseconds"<<std::endl;
     std::cout<<"t Overall                   = "<<std::setw(15)<<Tmr_Overall.elapsed()                  <<" microseconds"<<std::endl;        
 
     //Free up memory, except for the resulting landscape height field prior to
     //exiting so that unnecessary space is not used when the model is not being
     //run.
     accum .clear();   accum .shrink_to_fit();
+    efact .clear();   efact .shrink_to_fit();
     rec   .clear();   rec   .shrink_to_fit();
     ndon  .clear();   ndon  .shrink_to_fit();
     stack .clear();   stack .shrink_to_fit();
     donor .clear();   donor .shrink_to_fit();
+    stack_buf.clear(); stack_buf.shrink_to_fit();
+    todo_buf .clear(); todo_buf .shrink_to_fit();
+    depth    .clear(); depth    .shrink_to_fit();
+    big_cells.clear(); big_cells.shrink_to_fit();
+    level_count.clear(); level_count.shrink_to_fit();
   }
 
 
@@ -416,6 +723,13 @@ int main(int argc, char **argv){
   const std::string output_name =            argv[3] ;
   const auto        rand_seed   = std::stoul(argv[4]);
 
+  //Cells and donor slots are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(8.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
   seed_rand(rand_seed);
 
   //Uses the RichDEM machine-readable line prefixes
@@ -2,6 +2,7 @@
 //algorithm. The implementation was developed by adapting Fortran code provided
 //by Braun and attempts to be a faithful reproduction of the ideas therein.
 #include <array>
+#include <cassert>
 #include <cmath>
 #include <cstdlib>
 #include <fenv.h> //Used to catch floating point NaN issues
@@ -12,6 +13,8 @@
 #include "random.hpp"
 #include <vector>
 #include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ReceiverKernels.hpp"
 
 
 
@@ -63,7 +66,7 @@ class FastScape_BW {
   const double ueq       = 2e-3;   //Rate of uplift
   const double dt        = 1000.;  //Timestep interval
   const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
-  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler
+  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
   const double cell_area = 40000;  //Area of a single cell
 
 
@@ -85,11 +88,15 @@ class FastScape_BW {
 
   std::vector<double> h;        //Digital elevation model (height)
   std::vector<double> accum;    //Flow accumulation at each point
+  std::vector<double> efact;    //Prefactor of the implicit erosion equation at each cell (see ComputeErosionFactors())
+  double              inv_drn[8]; //1/dr^n for each direction
   std::vector<int>    rec;      //Direction of receiving cell
   std::vector<int>    donor;    //Indices of a cell's donor cells
   std::vector<int>    ndon;     //How many donors a cell has
   std::vector<int>    stack;    //Indices of cells in the order they should be processed
+  std::vector<int>    todo;     //Cells still to be visited while building the stack (see FindStack())
   std::array<int,8>   nshift;   //Offset from a focal cell's index to its neighbours in terms of flat indexing
+  ReceiverKernel      receiver_kernel; //Kernel used to find the receivers of a row of cells
 
   //Timers for keeping track of how long each part of the code takes
   CumulativeTimer Tmr_Step1_Initialize;
@@ -139,6 +146,8 @@ class FastScape_BW {
 
     h.resize(size);   //Memory for terrain height
 
+    receiver_kernel = SelectReceiverKernel(); //Fastest kernel this CPU supports
+
     GenerateRandomTerrain();     //Could replace this with custom initializer
 
     Tmr_Step1_Initialize.stop();
@@ -155,25 +164,11 @@ class FastScape_BW {
   void ComputeReceivers(){
     //Edge cells do not have receivers because they do not distribute their flow
     //to anywhere.
+
+    //Each row of interior cells is handed to the receiver kernel chosen when
+    //the model was constructed (see ReceiverKernels.hpp).
     for(int y=2;y<height-2;y++)
-    for(int x=2;x<width-2;x++){
-      const int c      = y*width+x;
-
-      //The slope must be greater than zero for there to be downhill flow;
-      //otherwise, the cell is marked NO_FLOW.
-      double max_slope = 0;        //Maximum slope seen so far amongst neighbours
-      int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
-
-      //Loop over neighbours
-      for(int n=0;n<8;n++){
-        const double slope = (h[c] - h[c+nshift[n]])/dr[n]; //Slope to neighbour n
-        if(slope>max_slope){    //Is this the steepest slope we've seen?
-          max_slope = slope;    //If so, make a note of the slope
-          max_n     = n;        //And which cell it came from
-        }
-      }
-      rec[c] = max_n;           //Having considered all neighbours, this is the steepest
-    }   
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
   }
 
 
@@ -198,11 +193,19 @@ class FastScape_BW {
   }
 
 
+  ///Appends the cells of the tree rooted at `c` to the stack in depth-first
+  ///pre-order: each cell comes before all of its donors. Long, sinuous rivers
+  ///make for very deep trees, so rather than recursing we keep the cells still
+  ///to be visited in `todo`. Donors are pushed in reverse so that they are
+  ///visited in the same order as a recursive search would visit them.
   void FindStack(const int c, int &nstack){
-    for(int k=0;k<ndon[c];k++){
-      const auto n    = donor[8*c+k];
-      stack[nstack++] = n;
-      FindStack(n,nstack);
+    todo.push_back(c);
+    while(!todo.empty()){
+      const int x = todo.back();
+      todo.pop_back();
+      stack[nstack++] = x;
+      for(int k=ndon[x]-1;k>=0;k--)
+        todo.push_back(donor[8*x+k]);
     }
   }
 
@@ -212,12 +215,9 @@ class FastScape_BW {
   ///such an order.
   void GenerateOrder(){
     int nstack=0;
-    for(int c=0;c<size;c++){
-      if(rec[c]==NO_FLOW){
-        stack[nstack++] = c;
+    for(int c=0;c<size;c++)
+      if(rec[c]==NO_FLOW)
         FindStack(c,nstack);
-      }
-    }  
   }
 
 
@@ -259,6 +259,20 @@ class FastScape_BW {
 
 
 
+  ///Fills `efact` with the prefactor K*dt*A^m/L^n of the implicit erosion
+  ///equation of every cell (see ErosionKernels.hpp). It depends only on the
+  ///flow accumulation and the receivers, so rather than being found cell by
+  ///cell during erosion it is computed for the whole DEM in one pass, which
+  ///vectorizes because PowPositive() stands in for std::pow and `inv_drn` for
+  ///the division. The value for a cell without a receiver is never used.
+  void ComputeErosionFactors(){
+    const double kdt = keq*dt;
+    for(int c=0;c<size;c++)
+      efact[c] = kdt*PowPositive(accum[c],meq)*inv_drn[rec[c]&7];
+  }
+
+
+
   ///Decrease he height of cells according to the stream power equation; that
   ///is, based on a constant K, flow accumulation A, the local slope between
   ///the cell and its receiving neighbour, and some judiciously-chosen constants
@@ -266,26 +280,19 @@ class FastScape_BW {
   ///    h_next = h_current - K*dt*(A^m)*(Slope)^n
   ///We solve this equation implicitly to preserve accuracy
   void Erode(){
+    ComputeErosionFactors();
+
     for(int s=0;s<size;s++){
       const int c = stack[s];            //Cell from which flow originates
       if(rec[c]==NO_FLOW)              //Ignore cells with no receiving neighbour
         continue;
       const int n = c+nshift[rec[c]];  //Cell receiving the flow
 
-      const double length = dr[rec[c]];
       //`fact` contains a set of values which are constant throughout the integration
-      const double fact   = keq*dt*std::pow(accum[c],meq)/std::pow(length,neq);
+      const double fact   = efact[c];
       const double h0     = h[c];      //Elevation of focal cell
       const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
-      double hnew         = h0;        //Current updated value of focal cell
-      double hp           = h0;        //Previous updated value of focal cell
-      double diff         = 2*tol;     //Difference between current and previous updated values
-      while(std::abs(diff)>tol){       //Newton-Rhapson method (run until subsequent values differ by less than a tolerance, which can be set to any desired precision)
-        hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
-        diff  = hnew - hp;             //Difference between previous and current value of the iteration
-        hp    = hnew;                  //Update previous value to new value
-      }
-      h[c] = hnew;                     //Update value in array
+      h[c] = ErodeCellImplicit(h0, hn, fact, neq, tol); //Update value in array (see ErosionKernels.hpp)
     }  
   }
 
@@ -306,6 +313,7 @@ class FastScape_BW {
     Tmr_Step1_Initialize.start();
 
     accum.resize(  size);  //Stores flow accumulation
+    efact.resize(  size);  //Stores the erosion prefactors
     rec.resize  (  size);  //Array of Receiver directions
     ndon.resize (  size);  //Number of donors each cell has
     donor.resize(8*size);  //Array listing the donors of each cell (up to 8 for a rectangular grid)
@@ -315,6 +323,13 @@ class FastScape_BW {
     for(int i=0;i<size;i++)
       rec[i] = NO_FLOW;
 
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
     Tmr_Step1_Initialize.stop();
 
     for(int step=0;step<=nstep;step++){
@@ -331,6 +346,8 @@ class FastScape_BW {
 
     Tmr_Overall.stop();
 
+    std::cout<<"m Receiver kernel = "<<ReceiverKernelName(receiver_kernel)<<std::endl;
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
     std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
     std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
     std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
@@ -344,10 +361,12 @@ class FastScape_BW {
     //exiting so that unnecessary space is not used when the model is not being
     //run.
     accum .clear();   accum .shrink_to_fit();
+    efact .clear();   efact .shrink_to_fit();
     rec   .clear();   rec   .shrink_to_fit();
     ndon  .clear();   ndon  .shrink_to_fit();
     stack .clear();   stack .shrink_to_fit();
     donor .clear();   donor .shrink_to_fit();
+    todo  .clear();   todo  .shrink_to_fit();
   }
 
 
@@ -379,6 +398,13 @@ int main(int argc, char **argv){
   const std::string output_name =            argv[3] ;
   const auto        rand_seed   = std::stoul(argv[4]);
 
+  //Cells and donor slots are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(8.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
   seed_rand(rand_seed);
 
   //Uses the RichDEM machine-readable line prefixes
@@ -9,6 +9,7 @@
 #include "random.hpp"
 #include <vector>
 #include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
 
 
 
@@ -60,6 +61,7 @@ class FastScape_RBGPU {
 
   double *h;        //Digital elevation model (height)
   double *accum;    //Flow accumulation at each point
+  double inv_drn[8];//1/dr^n for each direction, used with PowPositive() for the erosion prefactor
   int    *rec;      //Index of receiving cell
   int    *donor;    //Indices of a cell's donor cells
   int    *ndon;     //How many donors a cell has
@@ -324,20 +326,10 @@ class FastScape_RBGPU {
         const int c = stack[si];          //Cell from which flow originates
         const int n = c+nshift[rec[c]];   //Cell receiving the flow
 
-        const double length = dr[rec[c]];
-        const double fact   = keq*dt*std::pow(accum[c],meq)/std::pow(length,neq);
+        const double fact   = keq*dt*PowPositive(accum[c],meq)*inv_drn[rec[c]];
         const double h0     = h[c];        //Elevation of focal cell
         const double hn     = h[n];        //Elevation of neighbouring (receiving, lower) cell
-        double hnew         = h0;          //Current updated value of focal cell
-        double hp           = h0;          //Previous updated value of focal cell
-        double diff         = 2*tol;       //Difference between current and previous updated values
-        #pragma acc loop seq
-        while(std::abs(diff)>tol){
-          hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
-          diff  = hnew - hp;
-          hp    = hnew;
-        }
-        h[c] = hnew;
+        h[c] = ErodeCellImplicit(h0, hn, fact, neq, tol);
       }
     }
   }
@@ -354,6 +346,13 @@ class FastScape_RBGPU {
     ndon   = new int[size];
     donor  = new int[8*size];
 
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent. `inv_drn` must be set before the
+    //class is copied to the device.
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
 
     //! initializing rec
     //#pragma acc parallel loop present(this,rec)
@@ -401,6 +400,7 @@ class FastScape_RBGPU {
 
     Tmr_Overall.stop();
 
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
     std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
     std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
     std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
@@ -455,6 +455,13 @@ int main(int argc, char **argv){
   const int height = std::stoi(argv[1]);
   const int nstep  = std::stoi(argv[2]);
 
+  //Cells and donor slots are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(8.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
   CumulativeTimer tmr(true);
   FastScape_RBGPU tm(width,height);
   tm.run(nstep);
@@ -10,6 +10,8 @@
 #include "random.hpp"
 #include <vector>
 #include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ReceiverKernels.hpp"
 
 
 
@@ -61,7 +63,7 @@ class FastScape_RBP {
   const double ueq       = 2e-3;   //Rate of uplift
   const double dt        = 1000.;  //Timestep interval
   const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
-  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler
+  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
   const double cell_area = 40000;  //Area of a single cell
 
 
@@ -83,11 +85,14 @@ class FastScape_RBP {
 
   std::vector<double> h;        //Digital elevation model (height)
   std::vector<double> accum;    //Flow accumulation at each point
+  std::vector<double> efact;    //Prefactor of the implicit erosion equation at each cell (see ComputeErosionFactors())
+  double              inv_drn[8]; //1/dr^n for each direction
   std::vector<int>    rec;      //Direction of receiving cell
   std::vector<int>    donor;    //Indices of a cell's donor cells
   std::vector<int>    ndon;     //How many donors a cell has
   std::vector<int>    stack;    //Indices of cells in the order they should be processed
   std::array<int,8>   nshift;   //Offset from a focal cell's index to its neighbours in terms of flat indexing
+  ReceiverKernel      receiver_kernel; //Kernel used to find the receivers of a row of cells
 
   //A level is a set of cells which can all be processed simultaneously.
   //Topologically, cells within a level are neither descendents or ancestors of
@@ -147,6 +152,8 @@ class FastScape_RBP {
 
     h.resize(size);   //Memory for terrain height
 
+    receiver_kernel = SelectReceiverKernel(); //Fastest kernel this CPU supports
+
     GenerateRandomTerrain();     //Could replace this with custom initializer
 
     Tmr_Step1_Initialize.stop();
@@ -163,25 +170,11 @@ class FastScape_RBP {
   void ComputeReceivers(){
     //Edge cells do not have receivers because they do not distribute their flow
     //to anywhere.
+
+    //Each row of interior cells is handed to the receiver kernel chosen when
+    //the model was constructed (see ReceiverKernels.hpp).
     for(int y=2;y<height-2;y++)
-    for(int x=2;x<width-2;x++){
-      const int c      = y*width+x;
-
-      //The slope must be greater than zero for there to be downhill flow;
-      //otherwise, the cell is marked NO_FLOW.
-      double max_slope = 0;        //Maximum slope seen so far amongst neighbours
-      int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
-
-      //Loop over neighbours
-      for(int n=0;n<8;n++){
-        const double slope = (h[c] - h[c+nshift[n]])/dr[n]; //Slope to neighbour n
-        if(slope>max_slope){    //Is this the steepest slope we've seen?
-          max_slope = slope;    //If so, make a note of the slope
-          max_n     = n;        //And which cell it came from
-        }
-      }
-      rec[c] = max_n;           //Having considered all neighbours, this is the steepest
-    }    
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
   }
 
 
@@ -304,6 +297,21 @@ class FastScape_RBP {
 
 
 
+  ///Fills `efact` with the prefactor K*dt*A^m/L^n of the implicit erosion
+  ///equation of every cell (see ErosionKernels.hpp). It depends only on the
+  ///flow accumulation and the receivers, so rather than being found cell by
+  ///cell during erosion it is computed for the whole DEM in one pass, which
+  ///vectorizes because PowPositive() stands in for std::pow and `inv_drn` for
+  ///the division. The value for a cell without a receiver is never used.
+  void ComputeErosionFactors(){
+    const double kdt = keq*dt;
+    #pragma omp parallel for simd
+    for(int c=0;c<size;c++)
+      efact[c] = kdt*PowPositive(accum[c],meq)*inv_drn[rec[c]&7];
+  }
+
+
+
   ///Decrease he height of cells according to the stream power equation; that
   ///is, based on a constant K, flow accumulation A, the local slope between
   ///the cell and its receiving neighbour, and some judiciously-chosen constants
@@ -311,6 +319,8 @@ class FastScape_RBP {
   ///    h_next = h_current - K*dt*(A^m)*(Slope)^n
   ///We solve this equation implicitly to preserve accuracy
   void Erode(){
+    ComputeErosionFactors();
+
     //The cells in each level can be processed in parallel, so we loop over
     //levels starting from the lower-most (the one closest to the NO_FLOW cells)
 
@@ -332,20 +342,11 @@ class FastScape_RBP {
           continue;
         const int n = c+nshift[rec[c]];  //Cell receiving the flow
 
-        const double length = dr[rec[c]];
         //`fact` contains a set of values which are constant throughout the integration
-        const double fact   = keq*dt*std::pow(accum[c],meq)/std::pow(length,neq);
+        const double fact   = efact[c];
         const double h0     = h[c];      //Elevation of focal cell
         const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
-        double hnew         = h0;        //Current updated value of focal cell
-        double hp           = h0;        //Previous updated value of focal cell
-        double diff         = 2*tol;     //Difference between current and previous updated values
-        while(std::abs(diff)>tol){       //Newton-Rhapson method (run until subsequent values differ by less than a tolerance, which can be set to any desired precision)
-          hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
-          diff  = hnew - hp;             //Difference between previous and current value of the iteration
-          hp    = hnew;                  //Update previous value to new value
-        }
-        h[c] = hnew;                     //Update value in array
+        h[c] = ErodeCellImplicit(h0, hn, fact, neq, tol); //Update value in array (see ErosionKernels.hpp)
       }
     }
   }
@@ -369,6 +370,7 @@ class FastScape_RBP {
     level_width = size; //Number of level entries available to each thread
 
     accum.resize(  size);  //Stores flow accumulation
+    efact.resize(  size);  //Stores the erosion prefactors
     rec.resize  (  size);  //Array of Receiver directions
     ndon.resize (  size);  //Number of donors each cell has
     donor.resize(8*size);  //Array listing the donors of each cell (up to 8 for a rectangular grid)
@@ -387,6 +389,13 @@ class FastScape_RBP {
     for(int i=0;i<size;i++)
       rec[i] = NO_FLOW;
 
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
     Tmr_Step1_Initialize.stop();
 
     for(int step=0;step<=nstep;step++){
@@ -403,6 +412,8 @@ class FastScape_RBP {
 
     Tmr_Overall.stop();
 
+    std::cout<<"m Receiver kernel = "<<ReceiverKernelName(receiver_kernel)<<std::endl;
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
     std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
     std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
     std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
@@ -416,6 +427,7 @@ class FastScape_RBP {
     //exiting so that unnecessary space is not used when the model is not being
     //run.
     accum .clear();   accum .shrink_to_fit();
+    efact .clear();   efact .shrink_to_fit();
     rec   .clear();   rec   .shrink_to_fit();
     ndon  .clear();   ndon  .shrink_to_fit();
     stack .clear();   stack .shrink_to_fit();
@@ -452,6 +464,13 @@ int main(int argc, char **argv){
   const std::string output_name =            argv[3] ;
   const auto        rand_seed   = std::stoul(argv[4]);
 
+  //Cells and donor slots are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(8.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
   seed_rand(rand_seed);
 
   //Uses the RichDEM machine-readable line prefixes
@@ -0,0 +1,531 @@
+//This file contains a variant of the RB+PI algorithm which stores the flow
+//graph compactly. Rather than an `int` receiver, an `int` donor count, and
+//eight `int` donor slots per cell (40 bytes), each cell stores its receiver
+//direction in an `int8_t` and its donors as an 8-bit mask of the directions
+//from which it receives flow (2 bytes). Donors are recovered from the mask
+//through `nshift` and the number of donors is the mask's popcount. Since donors
+//are visited in the same direction order as RB+PI, the results are identical.
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fenv.h> //Used to catch floating point NaN issues
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include "random.hpp"
+#include <vector>
+#include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ReceiverKernels.hpp"
+
+
+
+///This is a quick-and-dirty, zero-dependency function for saving the outputs of
+///the model in ArcGIS ASCII DEM format (aka Arc/Info ASCII Grid, AAIGrid).
+///Production code for experimentation should probably use GeoTIFF or a similar
+///format as it will have a smaller file size and, thus, save quicker.
+void PrintDEM(
+  const std::string filename, 
+  const std::vector<double>& h,
+  const int width,
+  const int height
+){
+  std::ofstream fout(filename.c_str());
+  //Since the outer ring of the dataset is a halo used for simplifying
+  //neighbour-finding logic, we do not save it to the output here.
+  fout<<"ncols "<<(width- 2)<<"\n";
+  fout<<"nrows "<<(height-2)<<"\n";
+  fout<<"xllcorner 637500.000\n"; //Arbitrarily chosen value
+  fout<<"yllcorner 206000.000\n"; //Arbitrarily chosen value
+  fout<<"cellsize 500.000\n";     //Arbitrarily chosen value
+  fout<<"NODATA_value -9999\n";   //Value which is guaranteed not to correspond to an actual data value
+  for(int y=1;y<height-1;y++){
+    for(int x=1;x<width-1;x++)
+      fout<<h[y*width+x]<<" ";
+    fout<<"\n";
+  }
+}
+
+
+
+///The entire model is contained in a handy class, which makes it easy to set up
+///and solve many such models.
+class FastScape_RBPC {
+ private:
+  //Value used to indicate that a cell had no downhill neighbour and, thus, does
+  //not flow anywhere.
+  const int8_t NO_FLOW = -1;
+  const double SQRT2   = 1.414213562373095048801688724209698078569671875376948; //Yup, this is overkill.
+
+
+ public:
+  //NOTE: Having these constants specified in the class rather than globally
+  //results in a significant speed loss. However, it is better to have them here
+  //under the assumption that they'd be dynamic in a real implementation.
+  const double keq       = 2e-6;   //Stream power equation constant (coefficient)
+  const double neq       = 2;      //Stream power equation constant (slope modifier)
+  const double meq       = 0.8;    //Stream power equation constant (area modifier)
+  const double ueq       = 2e-3;   //Rate of uplift
+  const double dt        = 1000.;  //Timestep interval
+  const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
+  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
+  const double cell_area = 40000;  //Area of a single cell
+
+
+ private:
+  int width;        //Width of DEM
+  int height;       //Height of DEM
+  int size;         //Size of DEM (width*height)
+
+  //The dataset is set up so that the outermost edge is never actually used:
+  //it's a halo which allows every cell that is actually processed to consider
+  //its neighbours in all 8 directions without having to check first to see if
+  //it is an edge cell. The ring of second-most outer cells is set to a fixed
+  //value to which everything erodes (in this model).
+
+  //Rec directions (also used for nshift offsets) - see below for details
+  //1 2 3
+  //0   4
+  //7 6 5
+
+  std::vector<double> h;        //Digital elevation model (height)
+  std::vector<double> accum;    //Flow accumulation at each point
+  std::vector<double> efact;    //Prefactor of the implicit erosion equation at each cell (see ComputeErosionFactors())
+  double              inv_drn[8]; //1/dr^n for each direction
+  std::vector<int8_t>  rec;      //Direction of receiving cell
+  std::vector<uint8_t> donor;    //Bit `k` is set if the neighbour in direction `k` is a donor of the cell
+  std::vector<int>     stack;    //Indices of cells in the order they should be processed
+  std::array<int,8>    nshift;   //Offset from a focal cell's index to its neighbours in terms of flat indexing
+  ReceiverKernelT<int8_t> receiver_kernel; //Kernel used to find the receivers of a row of cells
+
+  //A level is a set of cells which can all be processed simultaneously.
+  //Topologically, cells within a level are neither descendents or ancestors of
+  //each other in a topological sorting, but are the same number of steps from
+  //the edge of the dataset.
+  std::vector<int>    levels;   //Indices of locations in stack where a level begins and ends
+  int    nlevel;    //Number of levels used
+
+  int stack_width;  //Number of cells allowed in the stack
+  int level_width;  //Number of cells allowed in a level
+
+  //Timers for keeping track of how long each part of the code takes
+  CumulativeTimer Tmr_Step1_Initialize;
+  CumulativeTimer Tmr_Step2_DetermineReceivers;
+  CumulativeTimer Tmr_Step3_DetermineDonors;
+  CumulativeTimer Tmr_Step4_GenerateOrder;
+  CumulativeTimer Tmr_Step5_FlowAcc;
+  CumulativeTimer Tmr_Step6_Uplift;
+  CumulativeTimer Tmr_Step7_Erosion;
+  CumulativeTimer Tmr_Overall;
+
+
+ private:
+  void GenerateRandomTerrain(){
+    //srand(std::random_device()());
+    for(int y=0;y<height;y++)
+    for(int x=0;x<width;x++){
+      const int c = y*width+x;
+      h[c]  = uniform_rand_real(0,1);
+
+      //Outer edge is set to 0 and never touched again. It is used only as a
+      //convenience so we don't have to worry when a focal cell looks at its
+      //neighbours.
+      if(x == 0 || y==0 || x==width-1 || y==height-1)
+        h[c] = 0;
+
+      //Second outer-most edge is set to 0 and never touched again. This is the
+      //baseline to which all cells would erode where it not for uplift. You can
+      //think of this as being "sea level".
+      if(x == 1 || y==1 || x==width-2 || y==height-2)
+        h[c] = 0;
+    }
+  }  
+
+
+ public:
+  ///Initializing code
+  FastScape_RBPC(const int width0, const int height0)
+    //Initialize code for finding neighbours of a cell
+    : nshift{-1,-width0-1,-width0,-width0+1,1,width0+1,width0,width0-1}
+  {
+    Tmr_Overall.start();
+    Tmr_Step1_Initialize.start();
+    width  = width0;
+    height = height0;
+    size   = width*height;
+
+    h.resize(size);   //Memory for terrain height
+
+    receiver_kernel = SelectReceiverKernel<int8_t>(); //Fastest kernel this CPU supports
+
+    GenerateRandomTerrain();     //Could replace this with custom initializer
+
+    Tmr_Step1_Initialize.stop();
+    Tmr_Overall.stop();
+  }
+
+
+
+ private:
+  ///The receiver of a focal cell is the cell which receives the focal cells'
+  ///flow. Here, we model the receiving cell as being the one connected to the
+  ///focal cell by the steppest gradient. If there is no local gradient, than
+  ///the special value NO_FLOW is assigned.
+  void ComputeReceivers(){
+    //Edge cells do not have receivers because they do not distribute their flow
+    //to anywhere.
+
+    //Each row of interior cells is handed to the receiver kernel chosen when
+    //the model was constructed (see ReceiverKernels.hpp).
+    #pragma omp parallel for
+    for(int y=2;y<height-2;y++)
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
+  }
+
+
+
+  ///The donors of a focal cell are the neighbours from which it receives flow.
+  ///Here, we identify those neighbours by inverting the Receivers array.
+  void ComputeDonors(){
+    //The B&W method of developing the donor array has each focal cell F inform
+    //its receiving cell R that F is a donor of R. Unfortunately, parallelizing
+    //this is difficult because more than one cell might be informing R at any
+    //given time. Atomics are a solution, but they impose a performance cost
+    //(though using the latest and greatest hardware decreases this penalty).
+
+    //Instead, we invert the operation. Each focal cell now examines its
+    //neighbours to see if it receives from them. Each focal cell is then
+    //guaranteed to have sole write-access to its location in the donor array.
+
+    //The neighbour in direction `ni` flows into the focal cell exactly when its
+    //receiver points back the opposite way, which is direction `(ni+4)%8` (see
+    //the diagram of directions above). This lets us build the mask without
+    //any branches.
+
+    //Remember, the outermost ring of cells is a convenience halo, so we don't
+    //calculate donors for it.
+
+    #pragma omp parallel for
+    for(int y=1;y<height-1;y++)
+    for(int x=1;x<width-1;x++){
+      const int c = y*width+x;
+      uint8_t mask = 0;
+      for(int ni=0;ni<8;ni++)
+        mask |= static_cast<uint8_t>((rec[c+nshift[ni]]==((ni+4)&7))<<ni);
+      donor[c] = mask;
+    }
+  }
+
+
+
+  ///Cells must be ordered so that they can be traversed such that higher cells
+  ///are processed before their lower neighbouring cells. This method creates
+  ///such an order. It also produces a list of "levels": cells which are,
+  ///topologically, neither higher nor lower than each other. Cells in the same
+  ///level can all be processed simultaneously without having to worry about
+  ///race conditions.
+  void GenerateOrder(){
+    int nstack = 0;    //Number of cells currently in the stack
+
+    //Since each value of the `levels` array is later used as the starting value
+    //of a for-loop, we include a zero at the beginning of the array.
+    levels[0] = 0;
+    nlevel    = 1;     //Note that array now contains a single value
+
+    //Load cells without dependencies into the queue. This will include all of
+    //the edge cells.
+    for(int y=1;y<height-1;y++)
+    for(int x=1;x<width -1;x++){
+      const int c = y*width+x;
+      if(rec[c]==NO_FLOW){
+        stack[nstack++] = c;
+        assert(nstack<stack_width);
+      }
+    }
+    levels[nlevel++] = nstack; //Last cell of this level
+    assert(nlevel<level_width); 
+
+    //Start with level_bottom=-1 so we get into the loop, it is immediately
+    //replaced by level_top.
+    int level_bottom = -1;         //First cell of the current level
+    int level_top    =  0;         //Last cell of the current level
+
+    while(level_bottom<level_top){ //Enusre we parse all the cells
+      level_bottom = level_top;    //The top of the previous level we considered is the bottom of the current level
+      level_top    = nstack;       //The new top is the end of the stack (last cell added from the previous level)
+      for(int si=level_bottom;si<level_top;si++){
+        const auto c = stack[si];
+        //Load donating neighbours of focal cell into the stack. The number of
+        //donors is the popcount of the mask and each pass through the loop
+        //peels off the mask's lowest set bit.
+        assert(nstack+__builtin_popcount(donor[c])<=stack_width);
+        for(unsigned int m=donor[c];m;m&=m-1)
+          stack[nstack++] = c+nshift[__builtin_ctz(m)];
+      }
+
+      levels[nlevel++] = nstack; //Start a new level
+    }
+
+    //End condition for the loop places two identical entries
+    //at the end of the stack. Remove one.
+    nlevel--;
+
+    assert(levels[nlevel-1]==nstack);
+  }
+
+
+
+  ///Compute the flow accumulation for each cell: the number of cells whose flow
+  ///ultimately passes through the focal cell multiplied by the area of each
+  ///cell. Each cell could also have its own weighting based on, say, average
+  ///rainfall.
+  void ComputeFlowAcc(){
+    //Initialize cell areas to their weights. Here, all the weights are the
+    //same.
+    for(int i=0;i<size;i++)
+      accum[i] = cell_area;
+
+    //Highly-elevated cells pass their flow to less elevated neighbour cells.
+    //The queue is ordered so that higher cells are keyed to higher indices in
+    //the queue; therefore, parsing the queue in reverse ensures that fluid
+    //flows downhill.
+
+    //We can process the cells in each level in parallel. To prevent race
+    //conditions, each focal cell figures out what contirbutions it receives
+    //from its neighbours.
+
+    //`nlevel-1` is the upper bound of the stack.
+    //`nlevel-2` through `nlevel-1` are the cells which have no higher neighbours (top of the watershed)
+    //`nlevel-3` through `nlevel-2` are the first set of cells with higher neighbours, so this is where we start
+    for(int li=nlevel-3;li>=1;li--){
+      const int lvlstart = levels[li];      //Starting index of level in stack
+      const int lvlend   = levels[li+1];    //Ending index of level in stack
+      const int lvlsize  = lvlend-lvlstart; //Number of cells in the level
+
+      //It's only worth parallelizing if there are enough cells in the level.
+      //For small levels it is more efficient to run the code in serial. The if-
+      //clause in the OpenMP directive below can be adjusted to a suitable value
+      //to account for this.      
+      #pragma omp parallel for default(none) shared(li,lvlstart,lvlend) if(lvlsize>500)
+      for(int si=lvlstart;si<lvlend;si++){
+        const int c = stack[si];
+        for(unsigned int m=donor[c];m;m&=m-1)
+          accum[c] += accum[c+nshift[__builtin_ctz(m)]];
+      }
+    }    
+  }
+
+
+
+  ///Raise each cell in the landscape by some amount, otherwise it wil get worn
+  ///flat (in this model, with these settings)
+  void AddUplift(){
+    //We exclude two exterior rings of cells in this example. The outermost ring
+    //(the edges of the dataset) allows us to ignore the edges of the dataset,
+    //the second-most outer ring (the cells bordering the edge cells of the
+    //dataset) are fixed to a specified height in this model. All other cells
+    //have heights which actively change and they are altered here.
+    #pragma omp parallel for collapse(2)
+    for(int y=2;y<height-2;y++)
+    for(int x=2;x<width-2;x++){
+      const int c = y*width+x;
+      h[c] += ueq*dt;
+    }
+  }
+
+
+
+  ///Fills `efact` with the prefactor K*dt*A^m/L^n of the implicit erosion
+  ///equation of every cell (see ErosionKernels.hpp). It depends only on the
+  ///flow accumulation and the receivers, so rather than being found cell by
+  ///cell during erosion it is computed for the whole DEM in one pass, which
+  ///vectorizes because PowPositive() stands in for std::pow and `inv_drn` for
+  ///the division. The value for a cell without a receiver is never used.
+  void ComputeErosionFactors(){
+    const double kdt = keq*dt;
+    #pragma omp parallel for simd
+    for(int c=0;c<size;c++)
+      efact[c] = kdt*PowPositive(accum[c],meq)*inv_drn[rec[c]&7];
+  }
+
+
+
+  ///Decrease he height of cells according to the stream power equation; that
+  ///is, based on a constant K, flow accumulation A, the local slope between
+  ///the cell and its receiving neighbour, and some judiciously-chosen constants
+  ///m and n.
+  ///    h_next = h_current - K*dt*(A^m)*(Slope)^n
+  ///We solve this equation implicitly to preserve accuracy
+  void Erode(){
+    ComputeErosionFactors();
+
+    //The cells in each level can be processed in parallel, so we loop over
+    //levels starting from the lower-most (the one closest to the NO_FLOW cells)
+
+    //Level 0 contains all those cells which do not flow anywhere, so we skip it
+    //since their elevations will not be changed via erosion anyway.
+    for(int li=1;li<nlevel-1;li++){
+      const int lvlstart = levels[li];      //Starting index of level in stack
+      const int lvlend   = levels[li+1];    //Ending index of level in stack
+      const int lvlsize  = lvlend-lvlstart; //Number of cells in the level
+
+      //It's only worth parallelizing if there are enough cells in the level.
+      //For small levels it is more efficient to run the code in serial. The if-
+      //clause in the OpenMP directive below can be adjusted to a suitable value
+      //to account for this.
+      #pragma omp parallel for if(lvlsize>500)
+      for(int si=lvlstart;si<lvlend;si++){
+        const int c = stack[si];         //Cell from which flow originates
+        const int n = c+nshift[rec[c]];  //Cell receiving the flow
+
+        //`fact` contains a set of values which are constant throughout the integration
+        const double fact   = efact[c];
+        const double h0     = h[c];      //Elevation of focal cell
+        const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
+        h[c] = ErodeCellImplicit(h0, hn, fact, neq, tol); //Update value in array (see ErosionKernels.hpp)
+      }
+    }
+  }
+
+
+ public:
+
+  ///Run the model forward for a specified number of timesteps. No new
+  ///initialization is done. This allows the model to be stopped, the terrain
+  ///altered, and the model continued. For space-efficiency, a number of
+  ///temporary arrays are created each time this is run, so repeatedly running
+  ///this function for the same model will likely not be performant due to
+  ///reallocations. If that is your use case, you'll want to modify your code
+  ///appropriately.
+  void run(const int nstep){
+    Tmr_Overall.start();
+
+    Tmr_Step1_Initialize.start();
+
+    stack_width = size; //Number of stack entries available to each thread
+    level_width = size; //Number of level entries available to each thread
+
+    accum.resize(  size);  //Stores flow accumulation
+    efact.resize(  size);  //Stores the erosion prefactors
+    rec.resize  (  size);  //Array of Receiver directions
+    donor.resize(  size);  //Masks of the donors of each cell (up to 8 for a rectangular grid)
+    stack.resize(stack_width);  //Order in which to process cells
+
+    //It's difficult to know how much memory should be allocated for levels. For
+    //a square DEM with isotropic dispersion this is approximately sqrt(E/2). A
+    //diagonally tilted surface with isotropic dispersion may have sqrt(E)
+    //levels. A tortorously sinuous river may have up to E*E levels. We
+    //compromise and choose a number of levels equal to the perimiter because
+    //why not?
+    levels.resize(2*width+2*height); 
+
+    ///All receivers initially point to nowhere
+    #pragma omp parallel for
+    for(int i=0;i<size;i++)
+      rec[i] = NO_FLOW;
+
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
+    Tmr_Step1_Initialize.stop();
+
+    for(int step=0;step<=nstep;step++){
+      Tmr_Step2_DetermineReceivers.start ();   ComputeReceivers  (); Tmr_Step2_DetermineReceivers.stop ();
+      Tmr_Step3_DetermineDonors.start    ();   ComputeDonors     (); Tmr_Step3_DetermineDonors.stop    ();
+      Tmr_Step4_GenerateOrder.start      ();   GenerateOrder     (); Tmr_Step4_GenerateOrder.stop      ();
+      Tmr_Step5_FlowAcc.start            ();   ComputeFlowAcc    (); Tmr_Step5_FlowAcc.stop            ();
+      Tmr_Step6_Uplift.start             ();   AddUplift         (); Tmr_Step6_Uplift.stop             ();
+      Tmr_Step7_Erosion.start            ();   Erode             (); Tmr_Step7_Erosion.stop            ();
+
+      if( step%20==0 ) //Show progress
+        std::cout<<"p Step = "<<step<<std::endl;
+    }
+
+    Tmr_Overall.stop();
+
+    std::cout<<"m Receiver kernel = "<<ReceiverKernelName(receiver_kernel)<<std::endl;
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
+    std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
+    std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
+    std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
+    std::cout<<"t Step4: GenerateOrder      = "<<std::setw(15)<<Tmr_Step4_GenerateOrder.elapsed()      <<" microseconds"<<std::endl;                    
+    std::cout<<"t Step5: FlowAcc            = "<<std::setw(15)<<Tmr_Step5_FlowAcc.elapsed()            <<" microseconds"<<std::endl;              
+    std::cout<<"t Step6: Uplift             = "<<std::setw(15)<<Tmr_Step6_Uplift.elapsed()             <<" microseconds"<<std::endl;             
+    std::cout<<"t Step7: Erosion            = "<<std::setw(15)<<Tmr_Step7_Erosion.elapsed()            <<" microseconds"<<std::endl;              
+    std::cout<<"t Overall                   = "<<std::setw(15)<<Tmr_Overall.elapsed()                  <<" microseconds"<<std::endl;        
+
+    //Free up memory, except for the resulting landscape height field prior to
+    //exiting so that unnecessary space is not used when the model is not being
+    //run.
+    accum .clear();   accum .shrink_to_fit();
+    efact .clear();   efact .shrink_to_fit();
+    rec   .clear();   rec   .shrink_to_fit();
+    stack .clear();   stack .shrink_to_fit();
+    donor .clear();   donor .shrink_to_fit();
+    levels.clear();   levels.shrink_to_fit();
+  }
+
+
+
+  ///Returns a pointer to the data so that it can be copied, printed, &c.
+  std::vector<double>& getH() {
+    return h;
+  }
+};
+
+
+
+
+
+
+
+int main(int argc, char **argv){
+  //Enable this to stop the program if a floating-point exception happens
+  //feenableexcept(FE_ALL_EXCEPT);
+
+  if(argc!=5){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Dimension> <Steps> <Output Name> <Seed>"<<std::endl;
+    return -1;
+  }
+
+  const int         width       = std::stoi (argv[1]);
+  const int         height      = std::stoi (argv[1]);
+  const int         nstep       = std::stoi (argv[2]);
+  const std::string output_name =            argv[3] ;
+  const auto        rand_seed   = std::stoul(argv[4]);
+
+  //Cells are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(1.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
+  seed_rand(rand_seed);
+
+  //Uses the RichDEM machine-readable line prefixes
+  //Name of algorithm
+  std::cout<<"A FastScape RB+PC"<<std::endl;                
+  //Citation for algorithm
+  std::cout<<"C Richard Barnes TODO"<<std::endl;
+  //Git hash of code used to produce outputs of algorithm
+  std::cout<<"h git_hash    = "<<GIT_HASH<<std::endl;
+  //Random seed used to produce outputs
+  std::cout<<"m Random seed = "<<rand_seed<<std::endl;
+
+  CumulativeTimer tmr(true);
+  FastScape_RBPC tm(width,height);
+  tm.run(nstep);
+  std::cout<<"t Total calculation time    = "<<std::setw(15)<<tmr.elapsed()<<" microseconds"<<std::endl;
+
+  PrintDEM(output_name, tm.getH(), width, height);
+
+  return 0;
+}
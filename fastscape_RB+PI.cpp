@@ -1,15 +1,21 @@
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <fenv.h> //Used to catch floating point NaN issues
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <omp.h>  //Used for OpenMP run-time functions
 #include "random.hpp"
 #include <vector>
 #include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ReceiverKernels.hpp"
+#include "SpinBarrier.hpp"
 
 
 
@@ -56,14 +62,60 @@ class FastScape_RBPF {
   //results in a significant speed loss. However, it is better to have them here
   //under the assumption that they'd be dynamic in a real implementation.
   const double keq       = 2e-6;   //Stream power equation constant (coefficient)
-  const double neq       = 2;      //Stream power equation constant (slope modifier)
+  double       neq       = 2;      //Stream power equation constant (slope modifier); set with --neq
   const double meq       = 0.8;    //Stream power equation constant (area modifier)
   const double ueq       = 2e-3;   //Rate of uplift
   const double dt        = 1000.;  //Timestep interval
   const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
-  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler
+  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
   const double cell_area = 40000;  //Area of a single cell
 
+  //If true, receivers and donors are only recomputed for cells whose
+  //neighbourhoods have changed enough that their receivers might have changed.
+  //See ComputeReceiversIncremental(). The results are identical either way.
+  bool incremental = false;
+
+  //If true (requires `incremental`), the levels and flow accumulation are
+  //repaired using only the receivers which changed in a step rather than being
+  //rebuilt. See GenerateOrderIncremental() and ComputeFlowAccIncremental(). A
+  //full rebuild every `rebuild_interval` steps checks that the two agree.
+  bool incremental_order = false;
+  int  rebuild_interval  = 100;
+
+  //If true, flow accumulation and erosion synchronize level by level only on
+  //the trunks of large trees. Smaller subtrees are handed whole to a thread.
+  //See PlanHybrid(). Cannot be combined with `incremental_order`.
+  bool hybrid = false;
+
+  //If true, a single thread team runs the whole model rather than a new team
+  //being started for every level of every step. See RunPersistent(). Cannot be
+  //combined with the other modes.
+  bool persistent = false;
+
+  //If true, flow accumulation follows the donor counts rather than the levels.
+  //See ComputeFlowAccDependency(). Cannot be combined with `hybrid`.
+  bool dependency_flowacc = false;
+
+  //When the number of levels exceeds this fraction of the number of cells,
+  //the levels are too small to parallelize well, so flow accumulation switches
+  //to pointer jumping. See ComputeFlowAccPointerJumping().
+  double pointer_jump_fraction = 0.01;
+
+  //If true, erosion always uses Newton's method, even for exponents which have
+  //a closed-form solution, and counts its iterations (see ErodeCell())
+  bool newton = false;
+
+  //If true (requires `newton`), each cell's Newton iteration starts from its
+  //height plus the change erosion made to it in the previous step, rather than
+  //from its height alone
+  bool warm_start = false;
+
+  //If true, flow accumulation and erosion work on copies of the per-cell data
+  //renumbered into stack order, so that they stream through memory rather than
+  //jumping about the DEM. See ComputeFlowAccRenumbered(). Cannot be combined
+  //with the other modes.
+  bool renumber = false;
+
 
  private:
   int width;        //Width of DEM
@@ -83,11 +135,14 @@ class FastScape_RBPF {
 
   std::vector<double> h;        //Digital elevation model (height)
   std::vector<double> accum;    //Flow accumulation at each point
+  std::vector<double> efact;    //Prefactor of the implicit erosion equation at each cell (see ComputeErosionFactors())
+  double              inv_drn[8]; //1/dr^n for each direction
   std::vector<int>    rec;      //Direction of receiving cell
   std::vector<int>    donor;    //Indices of a cell's donor cells
   std::vector<int>    ndon;     //How many donors a cell has
   std::vector<int>    stack;    //Indices of cells in the order they should be processed
   std::array<int,8>   nshift;   //Offset from a focal cell's index to its neighbours in terms of flat indexing
+  ReceiverKernel      receiver_kernel; //Kernel used to find the receivers of a row of cells
 
   //A level is a set of cells which can all be processed simultaneously.
   //Topologically, cells within a level are neither descendents or ancestors of
@@ -97,7 +152,85 @@ class FastScape_RBPF {
   int    nlevel;    //Number of levels used
 
   int stack_width;  //Number of cells allowed in the stack
-  int level_width;  //Number of cells allowed in a level
+
+  //Used by GenerateOrder() to build levels in parallel
+  std::vector<std::vector<int>> order_buf;    //Each thread's portion of the level being built
+  std::vector<std::vector<int>> order_rec_buf; //Stack positions of the receivers of the cells in `order_buf` (renumbered mode only)
+  std::vector<int>              order_offset; //Where each thread's portion goes in the stack
+
+  //Used only by the incremental mode
+  std::vector<double>  budget;       //How much a cell's slopes may still drift before its receiver might change
+  std::vector<double>  drift;        //Bound on how much each cell's height changed, relative to its neighbours, during the last step
+  std::vector<uint8_t> donor_dirty;  //1 if a cell's donors must be recomputed
+  int64_t touched_receivers;         //Number of receivers recomputed in the current step
+  int64_t touched_donors;            //Number of donor lists recomputed in the current step
+  int64_t total_touched_receivers;   //Number of receivers recomputed over the whole run
+  int64_t total_touched_donors;      //Number of donor lists recomputed over the whole run
+
+  //Used only by the incremental order mode
+  std::vector<std::vector<std::pair<int,int>>> rec_changes; //Each thread's list of (cell, old receiver) pairs for receivers which changed this step
+  std::vector<int>              depth;       //Level each cell belongs to
+  std::vector<std::vector<int>> level_cells; //Cells belonging to each level
+  std::vector<int>              level_pos;   //Position of each cell in its entry of `level_cells`
+  std::vector<int>              dfs_stack;   //Scratch space for traversing subtrees
+  int64_t consistency_errors;                //Mismatches found by the periodic full rebuilds
+
+  //Used only by the hybrid mode
+  struct Subtree {
+    int thread; //Thread whose entry of `sub_buf` holds the subtree
+    int start;  //Where the subtree begins in that buffer
+    int end;    //Where the subtree ends in that buffer
+  };
+  int  hybrid_cells;                         //Subtrees with more than this many cells belong to the trunk
+  bool hybrid_ready;                         //True once `accum` holds a flow accumulation to plan with
+  std::vector<uint8_t>          trunk;       //1 if a cell is processed level by level
+  std::vector<int>              trunk_cells; //Cells of the trunk, ordered by level
+  std::vector<int>              trunk_levels;//Where each level begins in `trunk_cells`
+  int                           ntrunk_levels; //Number of levels containing trunk cells
+  std::vector<std::vector<int>> sub_buf;     //Each thread's subtrees, each in depth-first pre-order
+  std::vector<std::vector<std::pair<int,int>>> sub_seg; //Where each of a thread's subtrees begins and ends in its buffer
+  std::vector<std::vector<int>> todo_buf;    //Each thread's cells still to be visited (see AddSubtree())
+  std::vector<Subtree>          subtrees;    //All the subtrees
+  int64_t total_levels;                      //Levels over the whole run
+  int64_t total_trunk_levels;                //Levels which needed synchronization over the whole run
+
+  //Used only by the dependency-counting flow accumulation
+  std::vector<int> pending;                  //Number of each cell's donors whose flow accumulation is not yet final
+
+  //Used only by the pointer-jumping flow accumulation
+  std::vector<int>    jump;                  //Cell each cell's flow is currently passed on to, or -1
+  std::vector<int>    jump_next;             //Next round's `jump`
+  std::vector<double> accum_next;            //Next round's `accum`
+  int64_t pointer_jump_steps;                //Number of steps which used pointer jumping
+  int64_t pointer_jump_rounds;               //Number of rounds of pointer jumping over the whole run
+
+  //Used only by the linear erosion solver (see ErodeLinear())
+  std::vector<double> affine_a;              //Offset of the affine map from a cell's target's new height to its own
+  std::vector<double> affine_b;              //Slope of the same map
+  std::vector<double> affine_a_next;         //Next round's `affine_a`
+  std::vector<double> affine_b_next;         //Next round's `affine_b`
+
+  //Used only by the batched Newton solver (see ErodeLevelBatched())
+  double  newton_level_iterations;           //Sum over levels of the mean iterations per batch
+  int64_t newton_levels;                     //Number of levels solved in batches over the whole run
+
+  //Used only when `newton` is set
+  static constexpr int NEWTON_BINS = 16;     //Bins of the Newton histogram; the last also counts anything longer
+  std::vector<std::array<int64_t,NEWTON_BINS>> newton_hist; //Each thread's counts of cells by number of Newton iterations
+  std::vector<double> erosion_increment;     //Change erosion made to each cell's height in the previous step (`warm_start` only)
+
+  //Used only by the renumbered mode. Each is indexed by a cell's position in
+  //the stack rather than by the cell.
+  static constexpr int PREFETCH_DISTANCE = 16; //How many cells ahead to prefetch in gathers and scatters
+  std::vector<int>    sdon;                  //Position of the first donor; the others follow it, up to the next cell's first donor
+  std::vector<int>    srec;                  //Position of the receiver
+  std::vector<double> saccum;                //Flow accumulation
+  std::vector<double> sh;                    //Elevation
+
+  //Used only by the persistent mode
+  SpinBarrier level_barrier;                 //Separates the levels of ComputeFlowAccTeam() and ErodeTeam()
+  int     team_nstack;                       //Number of cells in the stack, shared by the team
+  int64_t total_level_barriers;              //Number of times `level_barrier` was used over the whole run
 
   //Timers for keeping track of how long each part of the code takes
   CumulativeTimer Tmr_Step1_Initialize;
@@ -147,6 +280,8 @@ class FastScape_RBPF {
 
     h.resize(size);   //Memory for terrain height
 
+    receiver_kernel = SelectReceiverKernel(); //Fastest kernel this CPU supports
+
     GenerateRandomTerrain();     //Could replace this with custom initializer
 
     Tmr_Step1_Initialize.stop();
@@ -164,27 +299,116 @@ class FastScape_RBPF {
     //Edge cells do not have receivers because they do not distribute their flow
     //to anywhere.
 
-    //We parallelize across all cells and use TODO
-    #pragma omp parallel for collapse(2)
+    //Each row of interior cells is handed to the receiver kernel chosen when
+    //the model was constructed (see ReceiverKernels.hpp).
+    #pragma omp parallel for
     for(int y=2;y<height-2;y++)
-    for(int x=2;x<width-2;x++){
-      const int c      = y*width+x;
-
-      //The slope must be greater than zero for there to be downhill flow;
-      //otherwise, the cell is marked NO_FLOW.
-      double max_slope = 0;        //Maximum slope seen so far amongst neighbours
-      int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
-
-      //Loop over neighbours
-      for(int n=0;n<8;n++){
-        const double slope = (h[c] - h[c+nshift[n]])/dr[n]; //Slope to neighbour n
-        if(slope>max_slope){    //Is this the steepest slope we've seen?
-          max_slope = slope;    //If so, make a note of the slope
-          max_n     = n;        //And which cell it came from
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
+  }
+
+
+
+  ///Recomputes the receiver of a single cell exactly as the receiver kernels
+  ///do. Returns the cell's budget: the gap between the steepest slope and the
+  ///runner-up (which may be the slope of 0 which separates flowing cells from
+  ///NO_FLOW cells), less an allowance for floating-point rounding. So long as
+  ///the gap stays positive the steepest neighbour cannot change.
+  double UpdateReceiver(const int c){
+    //Rounding allowance per unit of height. The computed slopes may be off by a
+    //few ulps of the heights they are computed from.
+    const double ROUNDING = 8*std::numeric_limits<double>::epsilon();
+
+    double max_slope = 0;        //Maximum slope seen so far amongst neighbours
+    double runner_up = -std::numeric_limits<double>::infinity(); //Second-largest slope seen so far
+    int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
+    double hmax      = std::abs(h[c]); //Largest height magnitude in the neighbourhood
+    for(int n=0;n<8;n++){
+      const double hn    = h[c+nshift[n]];
+      const double slope = (h[c] - hn)/dr[n];
+      hmax = std::max(hmax,std::abs(hn));
+      if(slope>max_slope){
+        runner_up = max_slope;
+        max_slope = slope;
+        max_n     = n;
+      } else if(slope>runner_up){
+        runner_up = slope;
+      }
+    }
+    rec[c] = max_n;
+    return (max_slope-runner_up) - ROUNDING*hmax;
+  }
+
+
+
+  ///Incremental alternative to ComputeReceivers(). Each cell carries a budget
+  ///equal to the gap between its steepest and second-steepest slopes. If every
+  ///height in a cell's 3x3 neighbourhood moves by at most `d` relative to the
+  ///others, each slope moves by at most 2d (since dr>=1), so the gap shrinks by
+  ///at most 4d. Uniform uplift moves every interior cell equally, so `drift`
+  ///holds only each cell's net change over the step. A cell's receiver is
+  ///recomputed only once its budget is exhausted. Late in a run, when erosion
+  ///nearly balances uplift, this is a small fraction of the cells. When a
+  ///receiver does change, the donor lists of its old and new receiving cells are
+  ///marked for recomputation.
+  void ComputeReceiversIncremental(){
+    int64_t ntouched = 0;
+
+    for(auto &tc: rec_changes)
+      tc.clear();
+
+    #pragma omp parallel for reduction(+:ntouched)
+    for(int y=2;y<height-2;y++){
+      //Spend each cell's budget. This is kept separate from the recomputation
+      //below so that the compiler can vectorize it.
+      for(int c=y*width+2;c<y*width+width-2;c++){
+        double dmax = drift[c]; //Largest drift in the 3x3 neighbourhood
+        for(int n=0;n<8;n++)
+          dmax = std::max(dmax,drift[c+nshift[n]]);
+        budget[c] -= 4*dmax;
+      }
+
+      for(int c=y*width+2;c<y*width+width-2;c++){
+        if(budget[c]>0)
+          continue;
+
+        const int old_rec = rec[c];
+        budget[c] = UpdateReceiver(c);
+        ntouched++;
+
+        if(rec[c]==old_rec)
+          continue;
+        if(incremental_order)
+          rec_changes[omp_get_thread_num()].emplace_back(c,old_rec);
+        if(old_rec!=NO_FLOW){
+          #pragma omp atomic write
+          donor_dirty[c+nshift[old_rec]] = 1;
+        }
+        if(rec[c]!=NO_FLOW){
+          #pragma omp atomic write
+          donor_dirty[c+nshift[rec[c]]] = 1;
         }
       }
-      rec[c] = max_n;           //Having considered all neighbours, this is the steepest
-    }    
+    }
+
+    touched_receivers        = ntouched;
+    total_touched_receivers += ntouched;
+  }
+
+
+
+  ///Finds the donors of a single cell by examining its neighbours. See
+  ///ComputeDonors() for details.
+  void FindDonors(const int c){
+    ndon[c] = 0; //Cell has no donor neighbours we know about
+    for(int ni=0;ni<8;ni++){
+      const int n = c+nshift[ni];
+      //If the neighbour has a receiving cell and that receiving cell is
+      //the current focal cell c
+      if(rec[n]!=NO_FLOW && n+nshift[rec[n]]==c){
+        donor[8*c+ndon[c]] = n;
+        ndon[c]++;
+      }
+    }
   }
 
 
@@ -207,18 +431,62 @@ class FastScape_RBPF {
 
     #pragma omp parallel for collapse(2)
     for(int y=1;y<height-1;y++)
+    for(int x=1;x<width-1;x++)
+      FindDonors(y*width+x);
+  }
+
+
+
+  ///Incremental alternative to ComputeDonors(). Only those cells which
+  ///ComputeReceiversIncremental() marked as having gained or lost a donor are
+  ///recomputed.
+  void ComputeDonorsIncremental(){
+    int64_t ntouched = 0;
+
+    #pragma omp parallel for collapse(2) reduction(+:ntouched)
+    for(int y=1;y<height-1;y++)
     for(int x=1;x<width-1;x++){
       const int c = y*width+x;
-      ndon[c] = 0; //Cell has no donor neighbours we know about
-      for(int ni=0;ni<8;ni++){
-        const int n = c+nshift[ni];
-        //If the neighbour has a receiving cell and that receiving cell is
-        //the current focal cell c
-        if(rec[n]!=NO_FLOW && n+nshift[rec[n]]==c){
-          donor[8*c+ndon[c]] = n;
-          ndon[c]++;
-        }
-      }
+      if(!donor_dirty[c])
+        continue;
+      FindDonors(c);
+      donor_dirty[c] = 0;
+      ntouched++;
+    }
+
+    touched_donors        = ntouched;
+    total_touched_donors += ntouched;
+  }
+
+
+
+  ///Appends the contents of each thread's `buf` to the stack. The buffers are
+  ///placed in order of thread number, so if each thread filled its buffer from
+  ///a contiguous slice of a statically-scheduled loop, the stack ends up in the
+  ///same order as it would had a single thread done all the work. A prefix sum
+  ///over the buffer sizes gives each thread the place to copy its buffer to.
+  ///Must be called by all threads of a parallel region. On return the cells
+  ///have been appended to the stack and `levels` has a new entry marking their
+  ///end. In the renumbered mode each thread's `order_rec_buf` is copied to
+  ///`srec` in the same way.
+  void AppendLevel(const std::vector<int> &buf, int &nstack){
+    const int tid = omp_get_thread_num();
+    order_offset[tid+1] = buf.size();
+    #pragma omp barrier
+    #pragma omp single
+    {
+      order_offset[0] = nstack;
+      for(int t=1;t<=omp_get_num_threads();t++)
+        order_offset[t] += order_offset[t-1];
+      nstack           = order_offset[omp_get_num_threads()];
+      levels[nlevel++] = nstack; //Start a new level
+      assert(nstack<=stack_width);
+      assert(nlevel<=static_cast<int>(levels.size()));
+    }
+    std::copy(buf.begin(), buf.end(), stack.begin()+order_offset[tid]);
+    if(renumber){
+      const auto &rbuf = order_rec_buf[tid];
+      std::copy(rbuf.begin(), rbuf.end(), srec.begin()+order_offset[tid]);
     }
   }
 
@@ -231,52 +499,345 @@ class FastScape_RBPF {
   ///level can all be processed simultaneously without having to worry about
   ///race conditions.
   void GenerateOrder(){
-    int nstack = 0;    //Number of cells currently in the stack
+    int nstack; //Number of cells currently in the stack
+
+    #pragma omp parallel
+    GenerateOrderTeam(nstack);
 
+    if(hybrid)
+      PlanHybrid();
+  }
+
+
+
+  ///Does the work of GenerateOrder(). Must be called by all threads of a
+  ///parallel region, with `nstack` shared between them.
+  void GenerateOrderTeam(int &nstack){
     //Since each value of the `levels` array is later used as the starting value
     //of a for-loop, we include a zero at the beginning of the array.
-    levels[0] = 0;
-    nlevel    = 1;     //Note that array now contains a single value
+    #pragma omp single
+    {
+      nstack    = 0;
+      levels[0] = 0;
+      nlevel    = 1;   //Note that array now contains a single value
+    }
+
+    //The levels are built by a breadth-first expansion from the NO_FLOW cells.
+    //Each thread expands a contiguous slice of the current level into its own
+    //buffer and the buffers are then concatenated (see AppendLevel()), so the
+    //resulting stack is identical to that of a serial expansion.
+    std::vector<int> &buf  = order_buf    [omp_get_thread_num()];
+    std::vector<int> &rbuf = order_rec_buf[omp_get_thread_num()];
 
     //Load cells without dependencies into the queue. This will include all of
     //the edge cells.
+    buf.clear();
+    rbuf.clear();
+    #pragma omp for collapse(2) schedule(static) nowait
     for(int y=1;y<height-1;y++)
     for(int x=1;x<width -1;x++){
       const int c = y*width+x;
-      if(rec[c]==NO_FLOW){
-        stack[nstack++] = c;
-        assert(nstack<stack_width);
-      }
+      if(rec[c]==NO_FLOW)
+        buf.push_back(c);
     }
-    levels[nlevel++] = nstack; //Last cell of this level
-    assert(nlevel<level_width); 
+    AppendLevel(buf, nstack);
 
-    //Start with level_bottom=-1 so we get into the loop, it is immediately
-    //replaced by level_top.
-    int level_bottom = -1;         //First cell of the current level
-    int level_top    =  0;         //Last cell of the current level
+    while(true){
+      //Wait for the previous level to be completely placed in the stack and
+      //for all threads to agree on where it is before going on
+      #pragma omp barrier
+      const int level_bottom = levels[nlevel-2]; //First cell of the current level
+      const int level_top    = levels[nlevel-1]; //Last cell of the current level
+      #pragma omp barrier
 
-    while(level_bottom<level_top){ //Enusre we parse all the cells
-      level_bottom = level_top;    //The top of the previous level we considered is the bottom of the current level
-      level_top    = nstack;       //The new top is the end of the stack (last cell added from the previous level)
-      for(int si=level_bottom;si<level_top;si++){
-        const auto c = stack[si];
-        //Load donating neighbours of focal cell into the stack
-        for(int k=0;k<ndon[c];k++){
-          const auto n = donor[8*c+k];
-          stack[nstack++] = n;
-          assert(nstack<=stack_width);
+      if(level_bottom==level_top) //Ensure we parse all the cells
+        break;
+
+      //It's only worth parallelizing if there are enough cells in the level.
+      //For small levels it is more efficient for a single thread to load the
+      //donors straight into the stack.
+      if(level_top-level_bottom<=500){
+        #pragma omp single
+        {
+          for(int si=level_bottom;si<level_top;si++){
+            const auto c = stack[si];
+            //Load donating neighbours of focal cell into the stack
+            for(int k=0;k<ndon[c];k++){
+              if(renumber)
+                srec[nstack] = si;
+              stack[nstack++] = donor[8*c+k];
+              assert(nstack<=stack_width);
+            }
+          }
+          levels[nlevel++] = nstack; //Start a new level
+          assert(nlevel<=static_cast<int>(levels.size()));
         }
+      } else {
+        buf.clear();
+        rbuf.clear();
+        #pragma omp for schedule(static) nowait
+        for(int si=level_bottom;si<level_top;si++){
+          const auto c = stack[si];
+          //Load donating neighbours of focal cell into the thread's buffer
+          for(int k=0;k<ndon[c];k++){
+            buf.push_back(donor[8*c+k]);
+            if(renumber)
+              rbuf.push_back(si);
+          }
+        }
+        AppendLevel(buf, nstack);
       }
-
-      levels[nlevel++] = nstack; //Start a new level
     }
 
     //End condition for the loop places two identical entries
     //at the end of the stack. Remove one.
-    nlevel--;
+    #pragma omp single
+    {
+      nlevel--;
+      assert(levels[nlevel-1]==nstack);
+    }
+  }
 
-    assert(levels[nlevel-1]==nstack);
+
+
+  ///Appends the subtree rooted at `c` to `buf` in depth-first pre-order, so
+  ///that each cell comes before its donors, and notes where it lies in `segs`.
+  ///Subtrees may be deep, so rather than recursing we keep the cells still to
+  ///be visited in `todo`.
+  void AddSubtree(const int c, std::vector<int> &buf, std::vector<std::pair<int,int>> &segs, std::vector<int> &todo){
+    const int start = buf.size();
+    todo.push_back(c);
+    while(!todo.empty()){
+      const int x = todo.back();
+      todo.pop_back();
+      buf.push_back(x);
+      for(int k=0;k<ndon[x];k++)
+        todo.push_back(donor[8*x+k]);
+    }
+    segs.emplace_back(start,buf.size());
+  }
+
+
+
+  ///Plans the hybrid schedule used by ComputeFlowAccHybrid() and ErodeHybrid().
+  ///Near the ridgetops the levels are small and numerous, so synchronizing on
+  ///each one is mostly overhead. Instead, we split the cells into a "trunk",
+  ///which is processed level by level as usual, and subtrees hanging off it,
+  ///each of which is processed start to finish by a single thread without any
+  ///synchronization.
+  ///
+  ///A cell belongs to the trunk if its flow accumulation from the previous step
+  ///exceeds `hybrid_cells` cells, as do all the cells downstream of it. The
+  ///receivers may have changed since that accumulation was computed, but by
+  ///including everything downstream we ensure no trunk cell lies upstream of a
+  ///subtree, so any estimate gives a correct schedule. Until a flow
+  ///accumulation is available, every cell is put in the trunk.
+  void PlanHybrid(){
+    const double trunk_accum = static_cast<double>(hybrid_cells)*cell_area;
+    const int    nlvl        = nlevel-1; //Number of levels
+
+    trunk_levels.resize(nlvl+1);
+
+    #pragma omp parallel
+    {
+      const int tid = omp_get_thread_num();
+
+      #pragma omp for
+      for(int c=0;c<size;c++)
+        trunk[c] = !hybrid_ready;
+
+      //Mark large cells and everything downstream of them. Walks stop when they
+      //meet a cell some other walk has marked, so each cell is visited O(1)
+      //times.
+      if(hybrid_ready){
+        #pragma omp for schedule(dynamic,4096)
+        for(int c=0;c<size;c++){
+          if(accum[c]<=trunk_accum)
+            continue;
+          int x = c;
+          while(true){
+            uint8_t marked;
+            #pragma omp atomic read
+            marked = trunk[x];
+            if(marked)
+              break;
+            #pragma omp atomic write
+            trunk[x] = 1;
+            if(rec[x]==NO_FLOW)
+              break;
+            x += nshift[rec[x]];
+          }
+        }
+      }
+
+      //Count the trunk cells in each level
+      #pragma omp for schedule(dynamic)
+      for(int li=0;li<nlvl;li++){
+        int count = 0;
+        for(int si=levels[li];si<levels[li+1];si++)
+          count += trunk[stack[si]];
+        trunk_levels[li+1] = count;
+      }
+
+      //The trunk is closed downstream, so the levels containing it are a prefix
+      //of all the levels
+      #pragma omp single
+      {
+        trunk_levels[0] = 0;
+        ntrunk_levels   = 0;
+        for(int li=0;li<nlvl;li++){
+          if(trunk_levels[li+1]>0)
+            ntrunk_levels = li+1;
+          trunk_levels[li+1] += trunk_levels[li];
+        }
+        trunk_cells.resize(trunk_levels[nlvl]);
+      }
+
+      //Gather the trunk, level by level, and the subtrees. A subtree is rooted
+      //either at a non-trunk donor of a trunk cell or at a non-trunk NO_FLOW
+      //cell.
+      auto &buf  = sub_buf[tid];
+      auto &segs = sub_seg[tid];
+      buf.clear();
+      segs.clear();
+      #pragma omp for schedule(dynamic)
+      for(int li=0;li<nlvl;li++){
+        int fill = trunk_levels[li];
+        for(int si=levels[li];si<levels[li+1];si++){
+          const int c = stack[si];
+          if(trunk[c]){
+            trunk_cells[fill++] = c;
+            for(int k=0;k<ndon[c];k++){
+              const auto n = donor[8*c+k];
+              if(!trunk[n])
+                AddSubtree(n,buf,segs,todo_buf[tid]);
+            }
+          } else if(li==0){
+            AddSubtree(c,buf,segs,todo_buf[tid]);
+          }
+        }
+      }
+
+      #pragma omp single
+      {
+        subtrees.clear();
+        for(unsigned int t=0;t<sub_seg.size();t++)
+        for(const auto &seg: sub_seg[t])
+          subtrees.push_back(Subtree{static_cast<int>(t),seg.first,seg.second});
+      }
+    }
+
+    total_levels       += nlvl;
+    total_trunk_levels += ntrunk_levels;
+  }
+
+
+
+  ///Moves cell `c` into level `d`, keeping `level_cells` and `level_pos` in
+  ///sync. Removal from the old level swaps the last cell of that level into the
+  ///vacated slot, so both operations are O(1).
+  void MoveToLevel(const int c, const int d){
+    auto &from      = level_cells[depth[c]];
+    const int last  = from.back();
+    from[level_pos[c]] = last;
+    level_pos[last]    = level_pos[c];
+    from.pop_back();
+
+    if(d>=static_cast<int>(level_cells.size()))
+      level_cells.resize(d+1);
+    level_pos[c] = level_cells[d].size();
+    level_cells[d].push_back(c);
+    depth[c] = d;
+  }
+
+
+
+  ///Rebuilds `depth`, `level_cells`, and `level_pos` from the stack and levels
+  ///produced by GenerateOrder(). If `check` is true, the levels held by the
+  ///incremental mode are first compared against the freshly built ones.
+  void ResetIncrementalOrder(const bool check){
+    for(int li=0;li<nlevel-1;li++)
+    for(int si=levels[li];si<levels[li+1];si++){
+      const int c = stack[si];
+      if(check && depth[c]!=li)
+        consistency_errors++;
+      depth[c] = li;
+    }
+
+    level_cells.resize(nlevel-1);
+    for(int li=0;li<nlevel-1;li++){
+      level_cells[li].assign(stack.begin()+levels[li], stack.begin()+levels[li+1]);
+      for(int i=0;i<static_cast<int>(level_cells[li].size());i++)
+        level_pos[level_cells[li][i]] = i;
+    }
+  }
+
+
+
+  ///Incremental alternative to GenerateOrder(). A cell's level is its distance
+  ///from the NO_FLOW cell its flow ends at. When a cell's receiver changes, its
+  ///level and those of all the cells upstream of it shift by the same amount,
+  ///so only these subtrees are walked. If a changed cell lies in the subtree of
+  ///another, whichever is processed last leaves it at the right level. Rather
+  ///than a stack, the levels are kept as lists of cells (`level_cells`).
+  void GenerateOrderIncremental(){
+    for(const auto &tc: rec_changes)
+    for(const auto &ch: tc){
+      const int c = ch.first;
+      const int d = (rec[c]==NO_FLOW) ? 0 : depth[c+nshift[rec[c]]]+1;
+      if(d==depth[c])
+        continue;
+
+      MoveToLevel(c,d);
+      dfs_stack.push_back(c);
+      while(!dfs_stack.empty()){
+        const int x = dfs_stack.back();
+        dfs_stack.pop_back();
+        for(int k=0;k<ndon[x];k++){
+          const auto n = donor[8*x+k];
+          MoveToLevel(n,depth[x]+1);
+          dfs_stack.push_back(n);
+        }
+      }
+    }
+
+    //Levels at the top may have been emptied
+    while(level_cells.size()>1 && level_cells.back().empty())
+      level_cells.pop_back();
+  }
+
+
+
+  ///Adds `delta` to the flow accumulation of every cell downstream of `c`
+  void AddDownstream(int c, const double delta){
+    while(rec[c]!=NO_FLOW){
+      c         = c+nshift[rec[c]];
+      accum[c] += delta;
+    }
+  }
+
+
+
+  ///Incremental alternative to ComputeFlowAcc(). Changing the receiver of a
+  ///single cell `c` removes `accum[c]` from every cell on its old path to a
+  ///NO_FLOW cell and adds it to every cell on its new path, while leaving
+  ///`accum[c]` itself alone. Applying the changes one at a time, with the
+  ///receivers of the cells not yet processed at their old values, keeps each
+  ///path correct. Since the accumulations are sums of `cell_area`, which is an
+  ///integer, the updates are exact and agree bit-for-bit with ComputeFlowAcc().
+  void ComputeFlowAccIncremental(){
+    //Put back the old receivers, remembering the new ones
+    for(auto &tc: rec_changes)
+    for(auto &ch: tc)
+      std::swap(rec[ch.first],ch.second);
+
+    for(const auto &tc: rec_changes)
+    for(const auto &ch: tc){
+      const int c = ch.first;
+      AddDownstream(c,-accum[c]);
+      rec[c] = ch.second;
+      AddDownstream(c, accum[c]);
+    }
   }
 
 
@@ -286,6 +847,29 @@ class FastScape_RBPF {
   ///cell. Each cell could also have its own weighting based on, say, average
   ///rainfall.
   void ComputeFlowAcc(){
+    if(renumber){
+      ComputeFlowAccRenumbered();
+      return;
+    }
+
+    if(dependency_flowacc){
+      ComputeFlowAccDependency();
+      return;
+    }
+
+    //Levels this numerous leave little parallelism in each one. This also
+    //serves the hybrid mode, since its trunk is then deep as well.
+    if(nlevel>pointer_jump_fraction*size){
+      ComputeFlowAccPointerJumping();
+      hybrid_ready = true;
+      return;
+    }
+
+    if(hybrid){
+      ComputeFlowAccHybrid();
+      return;
+    }
+
     //Initialize cell areas to their weights. Here, all the weights are the
     //same.
     for(int i=0;i<size;i++)
@@ -303,7 +887,10 @@ class FastScape_RBPF {
     //`nlevel-1` is the upper bound of the stack.
     //`nlevel-2` through `nlevel-1` are the cells which have no higher neighbours (top of the watershed)
     //`nlevel-3` through `nlevel-2` are the first set of cells with higher neighbours, so this is where we start
-    for(int li=nlevel-3;li>=1;li--){
+    //We go all the way down to level 0 so that the NO_FLOW cells also have
+    //correct accumulations. Erosion does not need these, but the incremental
+    //mode does, since a NO_FLOW cell may later gain a receiver.
+    for(int li=nlevel-3;li>=0;li--){
       const int lvlstart = levels[li];      //Starting index of level in stack
       const int lvlend   = levels[li+1];    //Ending index of level in stack
       const int lvlsize  = lvlend-lvlstart; //Number of cells in the level
@@ -312,7 +899,7 @@ class FastScape_RBPF {
       //For small levels it is more efficient to run the code in serial. The if-
       //clause in the OpenMP directive below can be adjusted to a suitable value
       //to account for this.      
-      #pragma omp parallel for default(none) shared(li) if(lvlsize>500)
+      #pragma omp parallel for default(none) shared(li,lvlstart,lvlend) if(lvlsize>500)
       for(int si=lvlstart;si<lvlend;si++){
         const int c = stack[si];
         for(int k=0;k<ndon[c];k++){
@@ -325,6 +912,237 @@ class FastScape_RBPF {
 
 
 
+  ///Alternative to ComputeFlowAcc() which needs neither the levels nor any
+  ///synchronization between them. Each cell counts down its donors as they
+  ///finish. Walks begin at the ridge cells, which have no donors. On finishing a
+  ///cell, a walk decrements its receiver's count; the walk which takes the
+  ///count to zero knows all of the receiver's donors are final, so it gathers
+  ///them into the receiver and carries on downstream. Every other walk stops.
+  ///Gathering, rather than each donor adding its flow to its receiver, avoids
+  ///atomic floating-point additions and sums the donors in the same order as
+  ///ComputeFlowAcc().
+  void ComputeFlowAccDependency(){
+    #pragma omp parallel
+    {
+      #pragma omp for
+      for(int i=0;i<size;i++){
+        accum[i]   = cell_area;
+        pending[i] = ndon[i];
+      }
+
+      #pragma omp for schedule(dynamic,1024)
+      for(int c=0;c<size;c++){
+        if(ndon[c]!=0)
+          continue;
+        int x = c;
+        while(rec[x]!=NO_FLOW){
+          const int n = x+nshift[rec[x]];
+          //The sequentially-consistent decrement orders this walk's writes to
+          //`accum` before the decrement, and the decrement before the reads
+          //below of whichever walk finishes `n`
+          int remaining;
+          #pragma omp atomic capture seq_cst
+          remaining = --pending[n];
+          if(remaining>0)
+            break;
+          for(int k=0;k<ndon[n];k++)
+            accum[n] += accum[donor[8*n+k]];
+          x = n;
+        }
+      }
+    }
+  }
+
+
+
+  ///Alternative to ComputeFlowAcc() whose number of rounds of synchronization
+  ///grows with the logarithm of the depth of the drainage network rather than
+  ///with the depth itself. Each cell starts by passing its area to its
+  ///receiver. In each round, every cell adds what it holds to the cell its
+  ///`jump` points to, and then `jump` is doubled: it is replaced by the target's
+  ///own `jump`. After round k, a cell holds the area of all the cells upstream
+  ///of it by fewer than 2^k steps, so once every `jump` has run past a NO_FLOW
+  ///cell each cell holds its full flow accumulation. This costs O(N log D) work
+  ///for a depth of D, against O(N) for the levels, so it is only used when the
+  ///levels are very numerous. The sums are of integer multiples of `cell_area`,
+  ///so they are exact and the result agrees bit-for-bit with ComputeFlowAcc().
+  void ComputeFlowAccPointerJumping(){
+    int active = 1; //Number of cells whose `jump` has not yet run out
+    #pragma omp parallel
+    {
+      #pragma omp for
+      for(int c=0;c<size;c++){
+        accum[c] = cell_area;
+        jump[c]  = (rec[c]==NO_FLOW) ? -1 : c+nshift[rec[c]];
+      }
+
+      while(active>0){
+        #pragma omp for
+        for(int c=0;c<size;c++)
+          accum_next[c] = accum[c];
+
+        #pragma omp single
+        active = 0;
+
+        #pragma omp for reduction(+:active)
+        for(int c=0;c<size;c++){
+          const int j = jump[c];
+          if(j==-1){
+            jump_next[c] = -1;
+            continue;
+          }
+          #pragma omp atomic
+          accum_next[j] += accum[c];
+          jump_next[c] = jump[j];
+          active      += (jump[j]!=-1);
+        }
+
+        #pragma omp single
+        {
+          accum.swap(accum_next);
+          jump.swap(jump_next);
+          pointer_jump_rounds++;
+        }
+      }
+    }
+
+    pointer_jump_steps++;
+  }
+
+
+
+  ///Alternative to ComputeFlowAcc() which works in stack order. Walking the
+  ///stack and reading `accum`, `ndon` and `donor` for each cell jumps all over
+  ///the DEM, so on large DEMs nearly every access misses the cache and the TLB.
+  ///Instead the sweep works on arrays indexed by position in the stack.
+  ///GenerateOrder() builds each level by appending the donors of each cell of
+  ///the level below in turn, reading the cell's donors as it goes, and in this
+  ///mode it records the position of each appended cell's receiver in `srec`.
+  ///Since the donors of consecutive cells follow one another, `srec` is sorted,
+  ///and the donors of the cell at position s are those from where `srec` first
+  ///reaches s to where it first passes s. One streaming pass finds these in
+  ///`sdon`, so nothing is gathered from the DEM. The sweep then reads `saccum`
+  ///of a contiguous run of cells in the level above, and both it and
+  ///ErodeRenumbered() stream through memory. The stack is rebuilt every step,
+  ///and so is the renumbering. The sums are in the same order as
+  ///ComputeFlowAcc()'s, so the results are the same.
+  void ComputeFlowAccRenumbered(){
+    const int nstack = levels[nlevel-1];
+
+    //Cells after the receiver of position d-1, up to and including the
+    //receiver of position d, have their first donor at or after d. Before the
+    //first donor and after the last, `srec` is taken to be -1 and nstack.
+    #pragma omp parallel for
+    for(int d=levels[1];d<=nstack;d++){
+      const int lo = (d==levels[1]) ? -1     : srec[d-1];
+      const int hi = (d==nstack)    ? nstack : srec[d];
+      for(int si=lo+1;si<=hi;si++)
+        sdon[si] = d;
+    }
+
+    //See ComputeFlowAcc()
+    for(int li=nlevel-2;li>=0;li--){
+      const int lvlstart = levels[li];
+      const int lvlend   = levels[li+1];
+      #pragma omp parallel for if(lvlend-lvlstart>500)
+      for(int si=lvlstart;si<lvlend;si++){
+        double acc = cell_area;
+        for(int d=sdon[si];d<sdon[si+1];d++)
+          acc += saccum[d];
+        saccum[si] = acc;
+      }
+    }
+  }
+
+
+
+  ///Alternative to Erode() which works in stack order. See
+  ///ComputeFlowAccRenumbered(). The elevations are gathered into stack order
+  ///after the uplift, eroded, and scattered back to the DEM, which the steps
+  ///finding receivers and donors need. The gather and scatter prefetch the
+  ///scattered elevations. In between, a cell's receiver is in the level below
+  ///and the receivers of consecutive cells are in order, so the reads of `sh`
+  ///stream too. The erosion prefactors replace the flow accumulations in
+  ///`saccum`, in one vectorized pass as in ComputeErosionFactors(). Rather than
+  ///gathering `rec` as well, the pass tells a cell's straight receivers, one
+  ///row or column away, from its diagonal ones by their offsets in the DEM.
+  void ErodeRenumbered(){
+    const int nstack = levels[nlevel-1];
+    const double kdt = keq*dt;
+
+    #pragma omp parallel for
+    for(int si=0;si<nstack;si++){
+      if(si+PREFETCH_DISTANCE<nstack)
+        __builtin_prefetch(&h[stack[si+PREFETCH_DISTANCE]]);
+      sh[si] = h[stack[si]];
+    }
+
+    //The NO_FLOW cells of level 0 have no receiver and are not eroded
+    #pragma omp parallel for simd
+    for(int si=levels[1];si<nstack;si++){
+      const int  offset   = std::abs(stack[srec[si]]-stack[si]);
+      const bool straight = offset==1 || offset==width;
+      saccum[si] = kdt*PowPositive(saccum[si],meq)*inv_drn[straight ? 0 : 1];
+    }
+
+    //See Erode()
+    for(int li=1;li<nlevel-1;li++){
+      const int lvlstart = levels[li];
+      const int lvlend   = levels[li+1];
+      #pragma omp parallel for if(lvlend-lvlstart>500)
+      for(int si=lvlstart;si<lvlend;si++)
+        sh[si] = ErodeCellImplicit(sh[si], sh[srec[si]], saccum[si], neq, tol);
+    }
+
+    //The NO_FLOW cells of level 0 are unchanged
+    #pragma omp parallel for
+    for(int si=levels[1];si<nstack;si++){
+      if(si+PREFETCH_DISTANCE<nstack)
+        __builtin_prefetch(&h[stack[si+PREFETCH_DISTANCE]], 1);
+      h[stack[si]] = sh[si];
+    }
+  }
+
+
+
+  ///Hybrid alternative to ComputeFlowAcc(). See PlanHybrid().
+  void ComputeFlowAccHybrid(){
+    #pragma omp parallel
+    {
+      #pragma omp for
+      for(int i=0;i<size;i++)
+        accum[i] = cell_area;
+
+      //Each subtree is parsed in reverse pre-order, so every cell passes its
+      //flow on after receiving all of its own. The subtree's root is skipped:
+      //its receiver is in the trunk and gathers the root's flow below.
+      #pragma omp for schedule(dynamic,16)
+      for(unsigned int i=0;i<subtrees.size();i++){
+        const auto &st  = subtrees[i];
+        const auto &buf = sub_buf[st.thread];
+        for(int si=st.end-1;si>st.start;si--){
+          const int c = buf[si];
+          const int n = c+nshift[rec[c]];
+          accum[n]   += accum[c];
+        }
+      }
+
+      //The trunk, level by level as in ComputeFlowAcc()
+      for(int li=ntrunk_levels-1;li>=0;li--){
+        #pragma omp for
+        for(int ti=trunk_levels[li];ti<trunk_levels[li+1];ti++){
+          const int c = trunk_cells[ti];
+          for(int k=0;k<ndon[c];k++)
+            accum[c] += accum[donor[8*c+k]];
+        }
+      }
+    }
+
+    hybrid_ready = true;
+  }
+
+
+
   ///Raise each cell in the landscape by some amount, otherwise it wil get worn
   ///flat (in this model, with these settings)
   void AddUplift(){
@@ -339,6 +1157,73 @@ class FastScape_RBPF {
       const int c = y*width+x;
       h[c] += ueq*dt;
     }
+
+    //In incremental mode, we note how far each cell has moved relative to its
+    //neighbours. Uplift moves every interior cell by the same amount, so only
+    //cells which are not subsequently eroded (and so do not keep pace with their
+    //eroded neighbours) drift. Erode() overwrites this for the cells it touches.
+    //The second term allows for rounding in the addition above.
+    if(incremental){
+      const double ROUNDING = 4*std::numeric_limits<double>::epsilon();
+      #pragma omp parallel for collapse(2)
+      for(int y=2;y<height-2;y++)
+      for(int x=2;x<width-2;x++){
+        const int c = y*width+x;
+        drift[c] = ueq*dt + ROUNDING*std::abs(h[c]);
+      }
+    }
+  }
+
+
+
+  ///Erodes a single cell. See Erode().
+  void ErodeCell(const int c){
+    const int n = c+nshift[rec[c]];  //Cell receiving the flow
+
+    //`fact` contains a set of values which are constant throughout the integration
+    const double fact   = efact[c];
+    const double h0     = h[c];      //Elevation of focal cell
+    const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
+    double hnew;                     //New elevation of focal cell (see ErosionKernels.hpp)
+    if(newton){
+      const double guess = warm_start ? h0+erosion_increment[c] : h0;
+      int iterations;
+      hnew = ErodeCellNewtonFrom(h0, hn, fact, neq, tol, guess, iterations);
+      newton_hist[omp_get_thread_num()][std::min(iterations,NEWTON_BINS)-1]++;
+      if(warm_start)
+        erosion_increment[c] = hnew-h0;
+    } else {
+      hnew = ErodeCellImplicit(h0, hn, fact, neq, tol);
+    }
+    h[c] = hnew;                     //Update value in array
+
+    //Net change of the cell's height over the step (see AddUplift())
+    if(incremental)
+      drift[c] = std::abs(hnew-h0+ueq*dt) + 4*std::numeric_limits<double>::epsilon()*std::abs(hnew);
+  }
+
+
+
+  ///Fills `efact` with the prefactor K*dt*A^m/L^n of the implicit erosion
+  ///equation of every cell (see ErosionKernels.hpp). It depends only on the
+  ///flow accumulation and the receivers, so rather than being found cell by
+  ///cell during erosion it is computed for the whole DEM in one pass, which
+  ///vectorizes because PowPositive() stands in for std::pow and `inv_drn` for
+  ///the division. The value for a cell without a receiver is never used.
+  void ComputeErosionFactors(){
+    #pragma omp parallel
+    ComputeErosionFactorsTeam();
+  }
+
+
+
+  ///Does the work of ComputeErosionFactors(). Must be called by all threads of
+  ///a parallel region.
+  void ComputeErosionFactorsTeam(){
+    const double kdt = keq*dt;
+    #pragma omp for simd
+    for(int c=0;c<size;c++)
+      efact[c] = kdt*PowPositive(accum[c],meq)*inv_drn[rec[c]&7];
   }
 
 
@@ -350,39 +1235,339 @@ class FastScape_RBPF {
   ///    h_next = h_current - K*dt*(A^m)*(Slope)^n
   ///We solve this equation implicitly to preserve accuracy
   void Erode(){
+    if(renumber){
+      ErodeRenumbered();
+      return;
+    }
+
+    ComputeErosionFactors();
+
     //The cells in each level can be processed in parallel, so we loop over
     //levels starting from the lower-most (the one closest to the NO_FLOW cells)
 
     //Level 0 contains all those cells which do not flow anywhere, so we skip it
     //since their elevations will not be changed via erosion anyway.
+
+    //For n=1 the implicit equation is linear and needs neither Newton's method
+    //nor the levels
+    if(neq==1 && !newton){
+      ErodeLinear();
+      return;
+    }
+
+    if(hybrid){
+      ErodeHybrid();
+      return;
+    }
+
+    //In the incremental order mode the levels are kept as lists of cells
+    //rather than as a stack
+    if(incremental_order){
+      for(unsigned int li=1;li<level_cells.size();li++){
+        const auto &lvl    = level_cells[li];
+        const int  lvlsize = lvl.size();
+        #pragma omp parallel for if(lvlsize>500)
+        for(int i=0;i<lvlsize;i++)
+          ErodeCell(lvl[i]);
+      }
+      return;
+    }
+
     for(int li=1;li<nlevel-1;li++){
       const int lvlstart = levels[li];      //Starting index of level in stack
       const int lvlend   = levels[li+1];    //Ending index of level in stack
       const int lvlsize  = lvlend-lvlstart; //Number of cells in the level
 
+      //Exponents with no closed-form solution need Newton's method, which is
+      //run on the cells of the level in SIMD batches
+      if(neq!=1 && neq!=2 && !newton){
+        ErodeLevelBatched(lvlstart, lvlend);
+        continue;
+      }
+
       //It's only worth parallelizing if there are enough cells in the level.
       //For small levels it is more efficient to run the code in serial. The if-
       //clause in the OpenMP directive below can be adjusted to a suitable value
       //to account for this.
       #pragma omp parallel for if(lvlsize>500)
-      for(int si=lvlstart;si<lvlend;si++){
-        const int c = stack[si];         //Cell from which flow originates
-        const int n = c+nshift[rec[c]];  //Cell receiving the flow
-
-        const double length = dr[rec[c]];
-        //`fact` contains a set of values which are constant throughout the integration
-        const double fact   = keq*dt*std::pow(accum[c],meq)/std::pow(length,neq);
-        const double h0     = h[c];      //Elevation of focal cell
-        const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
-        double hnew         = h0;        //Current updated value of focal cell
-        double hp           = h0;        //Previous updated value of focal cell
-        double diff         = 2*tol;     //Difference between current and previous updated values
-        while(std::abs(diff)>tol){       //Newton-Rhapson method (run until subsequent values differ by less than a tolerance, which can be set to any desired precision)
-          hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
-          diff  = hnew - hp;             //Difference between previous and current value of the iteration
-          hp    = hnew;                  //Update previous value to new value
+      for(int si=lvlstart;si<lvlend;si++)
+        ErodeCell(stack[si]);            //Cell from which flow originates
+    }
+  }
+
+
+
+  ///Erodes the cells [`lvlstart`,`lvlend`) of the stack, which must all belong
+  ///to a single level, with ErodeCellsNewton(). Each batch gathers the inputs
+  ///of EROSION_BATCH consecutive cells of the level, the last batch taking
+  ///whatever cells remain, solves them together, and scatters the new
+  ///elevations back. The result differs from that of ErodeCell() only by the
+  ///rounding of PowPositive() (see ErodeCellsNewton()).
+  void ErodeLevelBatched(const int lvlstart, const int lvlend){
+    const int lvlsize  = lvlend-lvlstart;
+    const int nbatches = (lvlsize+EROSION_BATCH-1)/EROSION_BATCH;
+    if(nbatches==0)
+      return;
+
+    int64_t iterations = 0;  //Iterations needed by all of the level's batches
+
+    #pragma omp parallel for reduction(+:iterations) if(lvlsize>500)
+    for(int b=0;b<nbatches;b++){
+      const int first  = lvlstart+b*EROSION_BATCH;
+      const int nlanes = std::min(EROSION_BATCH, lvlend-first);
+      double h0[EROSION_BATCH], hn[EROSION_BATCH], fact[EROSION_BATCH], hnew[EROSION_BATCH];
+      for(int l=0;l<nlanes;l++){
+        const int c = stack[first+l];
+        h0  [l] = h[c];
+        hn  [l] = h[c+nshift[rec[c]]];
+        fact[l] = efact[c];
+      }
+
+      iterations += ErodeCellsNewton(h0, hn, fact, hnew, nlanes, neq, tol);
+
+      for(int l=0;l<nlanes;l++){
+        const int c = stack[first+l];
+        h[c] = hnew[l];
+        //Net change of the cell's height over the step (see AddUplift())
+        if(incremental)
+          drift[c] = std::abs(hnew[l]-h0[l]+ueq*dt) + 4*std::numeric_limits<double>::epsilon()*std::abs(hnew[l]);
+      }
+    }
+
+    newton_level_iterations += static_cast<double>(iterations)/nbatches;
+    newton_levels++;
+  }
+
+
+  ///Alternative to Erode() for the linear stream power law, n=1. The implicit
+  ///equation for a cell c with receiver r is then
+  ///    h_new(c) = h0(c) - F(c)*(h_new(c)-h_new(r))
+  ///where F is `fact` in ErodeCell(). This solves exactly to
+  ///    h_new(c) = h0(c)/(1+F(c)) + F(c)/(1+F(c))*h_new(r),
+  ///an affine map from the new height of the receiver to that of the cell. The
+  ///new height of any cell is therefore a composition of affine maps along its
+  ///path to a NO_FLOW cell, whose height is fixed. These compositions are
+  ///evaluated by pointer jumping: each round, every cell composes its map with
+  ///that of the cell it points to and then points where that cell points (see
+  ///ComputeFlowAccPointerJumping()). The number of rounds grows with the
+  ///logarithm of the depth of the drainage network, so long rivers do not
+  ///serialize the step.
+  ///
+  ///Composing the maps in a different order than a sweep down the stack would
+  ///changes the rounding slightly, but there is no convergence tolerance.
+  void ErodeLinear(){
+    int active; //Number of cells whose `jump` has not yet run out
+    #pragma omp parallel
+    {
+      //A NO_FLOW cell maps to its own, fixed, height
+      #pragma omp for
+      for(int c=0;c<size;c++){
+        if(rec[c]==NO_FLOW){
+          affine_a[c] = h[c];
+          affine_b[c] = 0;
+          jump[c]     = -1;
+        } else {
+          const double fact = efact[c];
+          affine_a[c] = h[c]/(1+fact);
+          affine_b[c] = fact/(1+fact);
+          jump[c]     = c+nshift[rec[c]];
+        }
+      }
+
+      //Each thread keeps its own copy of the loop condition: another thread may
+      //already be resetting `active` for the next round while this one tests it
+      for(bool more=true;more;){
+        #pragma omp single
+        active = 0;
+
+        #pragma omp for reduction(+:active)
+        for(int c=0;c<size;c++){
+          const int j = jump[c];
+          if(j==-1){
+            affine_a_next[c] = affine_a[c];
+            affine_b_next[c] = affine_b[c];
+            jump_next[c]     = -1;
+            continue;
+          }
+          affine_a_next[c] = affine_a[c]+affine_b[c]*affine_a[j];
+          affine_b_next[c] = affine_b[c]*affine_b[j];
+          jump_next[c]     = jump[j];
+          active          += (jump[j]!=-1);
+        }
+        more = active>0;
+
+        #pragma omp single
+        {
+          affine_a.swap(affine_a_next);
+          affine_b.swap(affine_b_next);
+          jump.swap(jump_next);
+        }
+      }
+
+      //Every map now ends at a NO_FLOW cell, so its offset is the new height
+      #pragma omp for
+      for(int c=0;c<size;c++){
+        if(rec[c]==NO_FLOW)
+          continue;
+        const double h0 = h[c];
+        h[c] = affine_a[c];
+        //Net change of the cell's height over the step (see AddUplift())
+        if(incremental)
+          drift[c] = std::abs(h[c]-h0+ueq*dt) + 4*std::numeric_limits<double>::epsilon()*std::abs(h[c]);
+      }
+    }
+  }
+
+
+
+  ///Hybrid alternative to Erode(). See PlanHybrid(). The trunk goes first,
+  ///since the subtrees drain into it.
+  void ErodeHybrid(){
+    #pragma omp parallel
+    {
+      for(int li=1;li<ntrunk_levels;li++){
+        #pragma omp for
+        for(int ti=trunk_levels[li];ti<trunk_levels[li+1];ti++)
+          ErodeCell(trunk_cells[ti]);
+      }
+
+      //Each subtree in pre-order, so every cell's receiver has already been
+      //eroded
+      #pragma omp for schedule(dynamic,16) nowait
+      for(unsigned int i=0;i<subtrees.size();i++){
+        const auto &st  = subtrees[i];
+        const auto &buf = sub_buf[st.thread];
+        for(int si=st.start;si<st.end;si++){
+          const int c = buf[si];
+          if(rec[c]!=NO_FLOW)
+            ErodeCell(c);
         }
-        h[c] = hnew;                     //Update value in array
+      }
+    }
+  }
+
+
+  ///The persistent mode's versions of the steps. Each must be called by all
+  ///threads of the team; see RunPersistent(). Work which is spread over whole
+  ///DEM uses OpenMP worksharing, whose barriers are few enough not to matter.
+  ///The levels use `level_barrier`. `sense` is the calling thread's sense for
+  ///that barrier.
+  void ComputeReceiversTeam(){
+    #pragma omp for
+    for(int y=2;y<height-2;y++)
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
+  }
+
+  void ComputeDonorsTeam(){
+    #pragma omp for collapse(2)
+    for(int y=1;y<height-1;y++)
+    for(int x=1;x<width-1;x++)
+      FindDonors(y*width+x);
+  }
+
+  ///Gives the calling thread its share, [`first`,`last`), of the cells
+  ///[`start`,`end`) of a level. Levels of 500 or fewer cells are not worth
+  ///dividing, so the first thread takes all of those while the others go
+  ///straight on to the barrier.
+  void LevelShare(const int start, const int end, int &first, int &last) const {
+    const int tid      = omp_get_thread_num();
+    const int nthreads = omp_get_num_threads();
+    if(end-start<=500){
+      first = start;
+      last  = (tid==0) ? end : start;
+    } else {
+      first = start+static_cast<int64_t>(end-start)*tid    /nthreads;
+      last  = start+static_cast<int64_t>(end-start)*(tid+1)/nthreads;
+    }
+  }
+
+  void ComputeFlowAccTeam(bool &sense){
+    #pragma omp for
+    for(int i=0;i<size;i++)
+      accum[i] = cell_area;
+
+    //See ComputeFlowAcc()
+    for(int li=nlevel-3;li>=0;li--){
+      int first, last;
+      LevelShare(levels[li], levels[li+1], first, last);
+      for(int si=first;si<last;si++){
+        const int c = stack[si];
+        for(int k=0;k<ndon[c];k++)
+          accum[c] += accum[donor[8*c+k]];
+      }
+      level_barrier.wait(sense);
+    }
+
+    #pragma omp master
+    total_level_barriers += std::max(nlevel-2,0);
+  }
+
+  void AddUpliftTeam(){
+    #pragma omp for collapse(2)
+    for(int y=2;y<height-2;y++)
+    for(int x=2;x<width-2;x++)
+      h[y*width+x] += ueq*dt;
+  }
+
+  void ErodeTeam(bool &sense){
+    ComputeErosionFactorsTeam();
+
+    //See Erode()
+    for(int li=1;li<nlevel-1;li++){
+      int first, last;
+      LevelShare(levels[li], levels[li+1], first, last);
+      for(int si=first;si<last;si++)
+        ErodeCell(stack[si]);
+      level_barrier.wait(sense);
+    }
+
+    #pragma omp master
+    total_level_barriers += std::max(nlevel-2,0);
+  }
+
+
+
+  ///Runs one step of the persistent mode, which every thread of the team calls,
+  ///and adds its time to `tmr`. The timers are shared, so only the master
+  ///thread starts and stops them. The barriers on either side mean the time
+  ///covers every thread's share of the step, not just the master's.
+  template<class Step>
+  void TimeTeamStep(CumulativeTimer &tmr, Step step){
+    #pragma omp barrier
+    #pragma omp master
+    tmr.start();
+    step();
+    #pragma omp barrier
+    #pragma omp master
+    tmr.stop();
+  }
+
+
+
+  ///Runs the steps of run() in a single parallel region. Starting and stopping
+  ///a team for each level of ComputeFlowAcc() and Erode() costs far more than
+  ///the work in most levels, so here the team lives for the whole run and the
+  ///levels are separated by a spin barrier. Each step is timed by
+  ///TimeTeamStep().
+  void RunPersistent(const int nstep){
+    #pragma omp parallel
+    {
+      #pragma omp single
+      level_barrier.reset(omp_get_num_threads());
+
+      bool sense = false; //This thread's sense for `level_barrier`
+
+      for(int step=0;step<=nstep;step++){
+        TimeTeamStep(Tmr_Step2_DetermineReceivers, [&]{ ComputeReceiversTeam();            });
+        TimeTeamStep(Tmr_Step3_DetermineDonors,    [&]{ ComputeDonorsTeam   ();            });
+        TimeTeamStep(Tmr_Step4_GenerateOrder,      [&]{ GenerateOrderTeam   (team_nstack); });
+        TimeTeamStep(Tmr_Step5_FlowAcc,            [&]{ ComputeFlowAccTeam  (sense);       });
+        TimeTeamStep(Tmr_Step6_Uplift,             [&]{ AddUpliftTeam       ();            });
+        TimeTeamStep(Tmr_Step7_Erosion,            [&]{ ErodeTeam           (sense);       });
+
+        #pragma omp master
+        if( step%20==0 ) //Show progress
+          std::cout<<"p Step = "<<step<<std::endl;
       }
     }
   }
@@ -403,43 +1588,164 @@ class FastScape_RBPF {
     Tmr_Step1_Initialize.start();
 
     stack_width = size; //Number of stack entries available to each thread
-    level_width = size; //Number of level entries available to each thread
 
     accum.resize(  size);  //Stores flow accumulation
+    efact.resize(  size);  //Stores the erosion prefactors
     rec.resize  (  size);  //Array of Receiver directions
     ndon.resize (  size);  //Number of donors each cell has
     donor.resize(8*size);  //Array listing the donors of each cell (up to 8 for a rectangular grid)
     stack.resize(stack_width);  //Order in which to process cells
 
-    //It's difficult to know how much memory should be allocated for levels. For
-    //a square DEM with isotropic dispersion this is approximately sqrt(E/2). A
-    //diagonally tilted surface with isotropic dispersion may have sqrt(E)
-    //levels. A tortorously sinuous river may have up to E*E levels. We
-    //compromise and choose a number of levels equal to the perimiter because
-    //why not?
-    levels.resize(2*width+2*height); 
+    //A square DEM with isotropic dispersion has approximately sqrt(E/2) levels,
+    //but a tortuously sinuous river may have as many levels as cells. Such deep
+    //networks are exactly those for which ComputeFlowAcc() switches to pointer
+    //jumping, so there must be room for them. Every level but the final, empty
+    //one holds at least one cell, and `levels` also holds the leading zero.
+    levels.resize(size+2);
+
+    order_buf.resize(omp_get_max_threads());
+    order_rec_buf.resize(omp_get_max_threads());
+    order_offset.resize(omp_get_max_threads()+1);
 
     ///All receivers initially point to nowhere
     #pragma omp parallel for
     for(int i=0;i<size;i++)
       rec[i] = NO_FLOW;
 
+    //In incremental mode every cell starts with no budget, so that the first
+    //step computes all receivers, and with dirty donors, so that the first step
+    //computes all donors.
+    if(incremental){
+      budget.assign     (size, 0);
+      drift.assign      (size, 0);
+      donor_dirty.assign(size, 1);
+      total_touched_receivers = 0;
+      total_touched_donors    = 0;
+    }
+
+    if(incremental_order){
+      rec_changes.resize(omp_get_max_threads());
+      depth.assign(size, 0);
+      level_pos.assign(size, 0);
+      consistency_errors = 0;
+    }
+
+    //Subtrees are made small enough that there are plenty of them to go around
+    if(hybrid){
+      hybrid_cells = std::max(256, size/(16*omp_get_max_threads()));
+      hybrid_ready = false;
+      trunk.resize(size);
+      sub_buf .resize(omp_get_max_threads());
+      sub_seg .resize(omp_get_max_threads());
+      todo_buf.resize(omp_get_max_threads());
+      total_levels       = 0;
+      total_trunk_levels = 0;
+    }
+
+    total_level_barriers = 0;
+
+    newton_level_iterations = 0;
+    newton_levels           = 0;
+
+    if(newton)
+      newton_hist.assign(omp_get_max_threads(), std::array<int64_t,NEWTON_BINS>());
+    if(warm_start)
+      erosion_increment.assign(size, 0);
+
+    if(renumber){
+      sdon  .resize(size+1);
+      srec  .resize(size);
+      saccum.resize(size);
+      sh    .resize(size);
+    }
+
+    if(dependency_flowacc)
+      pending.resize(size);
+
+    //Pointer jumping may switch on at any step
+    jump      .resize(size);
+    jump_next .resize(size);
+    accum_next.resize(size);
+
+    if(neq==1){
+      affine_a     .resize(size);
+      affine_b     .resize(size);
+      affine_a_next.resize(size);
+      affine_b_next.resize(size);
+    }
+    pointer_jump_steps  = 0;
+    pointer_jump_rounds = 0;
+
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    //So does the batched Newton solver, for the powers of the drop
+    if(neq!=1 && neq!=2)
+      assert(PowPositiveError(neq)<1e-13 && PowPositiveError(neq-1)<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
     Tmr_Step1_Initialize.stop();
 
-    for(int step=0;step<=nstep;step++){
-      Tmr_Step2_DetermineReceivers.start ();   ComputeReceivers  (); Tmr_Step2_DetermineReceivers.stop ();
-      Tmr_Step3_DetermineDonors.start    ();   ComputeDonors     (); Tmr_Step3_DetermineDonors.stop    ();
-      Tmr_Step4_GenerateOrder.start      ();   GenerateOrder     (); Tmr_Step4_GenerateOrder.stop      ();
-      Tmr_Step5_FlowAcc.start            ();   ComputeFlowAcc    (); Tmr_Step5_FlowAcc.stop            ();
+    if(persistent)
+      RunPersistent(nstep);
+
+    for(int step=0;step<=nstep && !persistent;step++){
+      if(incremental){
+        Tmr_Step2_DetermineReceivers.start (); ComputeReceiversIncremental(); Tmr_Step2_DetermineReceivers.stop ();
+        Tmr_Step3_DetermineDonors.start    (); ComputeDonorsIncremental   (); Tmr_Step3_DetermineDonors.stop    ();
+      } else {
+        Tmr_Step2_DetermineReceivers.start (); ComputeReceivers           (); Tmr_Step2_DetermineReceivers.stop ();
+        Tmr_Step3_DetermineDonors.start    (); ComputeDonors              (); Tmr_Step3_DetermineDonors.stop    ();
+      }
+      if(incremental_order && step>0){
+        Tmr_Step4_GenerateOrder.start    (); GenerateOrderIncremental   (); Tmr_Step4_GenerateOrder.stop      ();
+        Tmr_Step5_FlowAcc.start          (); ComputeFlowAccIncremental  (); Tmr_Step5_FlowAcc.stop            ();
+      }
+      if(!incremental_order || step%rebuild_interval==0){
+        //In the incremental order mode, this is a periodic full rebuild. We
+        //check that it agrees with the incremental results before replacing
+        //them.
+        std::vector<double> incremental_accum;
+        if(incremental_order && step>0)
+          incremental_accum = accum;
+        Tmr_Step4_GenerateOrder.start    (); GenerateOrder              (); Tmr_Step4_GenerateOrder.stop      ();
+        Tmr_Step5_FlowAcc.start          (); ComputeFlowAcc             (); Tmr_Step5_FlowAcc.stop            ();
+        if(incremental_order){
+          for(unsigned int i=0;i<incremental_accum.size();i++)
+            consistency_errors += (incremental_accum[i]!=accum[i]);
+          ResetIncrementalOrder(step>0);
+        }
+      }
       Tmr_Step6_Uplift.start             ();   AddUplift         (); Tmr_Step6_Uplift.stop             ();
       Tmr_Step7_Erosion.start            ();   Erode             (); Tmr_Step7_Erosion.stop            ();
 
-      if( step%20==0 ) //Show progress
+      if( step%20==0 ){ //Show progress
         std::cout<<"p Step = "<<step<<std::endl;
+        if(incremental)
+          std::cout<<"p Touched fraction: receivers = "<<(static_cast<double>(touched_receivers)/size)<<", donors = "<<(static_cast<double>(touched_donors)/size)<<std::endl;
+      }
     }
 
     Tmr_Overall.stop();
 
+    std::cout<<"m Receiver kernel = "<<ReceiverKernelName(receiver_kernel)<<std::endl;
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
+    if(incremental){
+      std::cout<<"m Mean touched fraction: receivers = "<<(static_cast<double>(total_touched_receivers)/size/(nstep+1))<<std::endl;
+      std::cout<<"m Mean touched fraction: donors    = "<<(static_cast<double>(total_touched_donors)   /size/(nstep+1))<<std::endl;
+    }
+    if(incremental_order)
+      std::cout<<"m Incremental order consistency errors = "<<consistency_errors<<std::endl;
+    if(pointer_jump_steps>0)
+      std::cout<<"m Pointer-jumping flow accumulation used in "<<pointer_jump_steps<<" steps, with "<<(static_cast<double>(pointer_jump_rounds)/pointer_jump_steps)<<" rounds per step"<<std::endl;
+    if(newton_levels>0)
+      std::cout<<"m Mean batched Newton iterations per level = "<<(newton_level_iterations/newton_levels)<<std::endl;
+    if(persistent)
+      std::cout<<"m Level barriers per step = "<<(static_cast<double>(total_level_barriers)/(nstep+1))<<std::endl;
+    if(hybrid)
+      std::cout<<"m Mean levels synchronized per step = "<<(static_cast<double>(total_trunk_levels)/(nstep+1))<<" of "<<(static_cast<double>(total_levels)/(nstep+1))<<std::endl;
     std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
     std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
     std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
@@ -447,17 +1753,59 @@ class FastScape_RBPF {
     std::cout<<"t Step5: FlowAcc            = "<<std::setw(15)<<Tmr_Step5_FlowAcc.elapsed()            <<" microseconds"<<std::endl;              
     std::cout<<"t Step6: Uplift             = "<<std::setw(15)<<Tmr_Step6_Uplift.elapsed()             <<" microseconds"<<std::endl;             
     std::cout<<"t Step7: Erosion            = "<<std::setw(15)<<Tmr_Step7_Erosion.elapsed()            <<" microseconds"<<std::endl;              
+    if(newton){
+      std::array<int64_t,NEWTON_BINS> counts = {};
+      for(const auto &th: newton_hist)
+      for(int i=0;i<NEWTON_BINS;i++)
+        counts[i] += th[i];
+      std::cout<<"m Step7: Newton iterations  =";
+      for(int i=0;i<NEWTON_BINS;i++)
+        if(counts[i]>0)
+          std::cout<<" "<<(i+1)<<((i+1==NEWTON_BINS) ? "+" : "")<<":"<<counts[i];
+      std::cout<<std::endl;
+    }
     std::cout<<"t Overall                   = "<<std::setw(15)<<Tmr_Overall.elapsed()                  <<" microseconds"<<std::endl;        
 
     //Free up memory, except for the resulting landscape height field prior to
     //exiting so that unnecessary space is not used when the model is not being
     //run.
     accum .clear();   accum .shrink_to_fit();
+    efact .clear();   efact .shrink_to_fit();
     rec   .clear();   rec   .shrink_to_fit();
     ndon  .clear();   ndon  .shrink_to_fit();
     stack .clear();   stack .shrink_to_fit();
     donor .clear();   donor .shrink_to_fit();
     levels.clear();   levels.shrink_to_fit();
+    order_buf   .clear(); order_buf   .shrink_to_fit();
+    order_rec_buf.clear(); order_rec_buf.shrink_to_fit();
+    order_offset.clear(); order_offset.shrink_to_fit();
+    budget.clear();   budget.shrink_to_fit();
+    drift .clear();   drift .shrink_to_fit();
+    donor_dirty.clear(); donor_dirty.shrink_to_fit();
+    rec_changes.clear(); rec_changes.shrink_to_fit();
+    depth      .clear(); depth      .shrink_to_fit();
+    level_cells.clear(); level_cells.shrink_to_fit();
+    level_pos  .clear(); level_pos  .shrink_to_fit();
+    dfs_stack  .clear(); dfs_stack  .shrink_to_fit();
+    trunk      .clear(); trunk      .shrink_to_fit();
+    trunk_cells.clear(); trunk_cells.shrink_to_fit();
+    sub_buf    .clear(); sub_buf    .shrink_to_fit();
+    sub_seg    .clear(); sub_seg    .shrink_to_fit();
+    todo_buf   .clear(); todo_buf   .shrink_to_fit();
+    subtrees   .clear(); subtrees   .shrink_to_fit();
+    pending    .clear(); pending    .shrink_to_fit();
+    jump       .clear(); jump       .shrink_to_fit();
+    jump_next  .clear(); jump_next  .shrink_to_fit();
+    accum_next .clear(); accum_next .shrink_to_fit();
+    affine_a   .clear(); affine_a   .shrink_to_fit();
+    affine_b   .clear(); affine_b   .shrink_to_fit();
+    affine_a_next.clear(); affine_a_next.shrink_to_fit();
+    affine_b_next.clear(); affine_b_next.shrink_to_fit();
+    erosion_increment.clear(); erosion_increment.shrink_to_fit();
+    sdon       .clear(); sdon       .shrink_to_fit();
+    srec       .clear(); srec       .shrink_to_fit();
+    saccum     .clear(); saccum     .shrink_to_fit();
+    sh         .clear(); sh         .shrink_to_fit();
   }
 
 
@@ -478,8 +1826,20 @@ int main(int argc, char **argv){
   //Enable this to stop the program if a floating-point exception happens
   //feenableexcept(FE_ALL_EXCEPT);
 
-  if(argc!=5){
-    std::cerr<<"Syntax: "<<argv[0]<<" <Dimension> <Steps> <Output Name> <Seed>"<<std::endl;
+  if(argc<5){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Dimension> <Steps> <Output Name> <Seed> [Options]"<<std::endl;
+    std::cerr<<"Options:"<<std::endl;
+    std::cerr<<"  --incremental         Only recompute receivers and donors of cells which may have changed"<<std::endl;
+    std::cerr<<"  --incremental-order   As above, and also repair levels and flow accumulation incrementally"<<std::endl;
+    std::cerr<<"  --hybrid              Synchronize level by level only on the trunks of large trees"<<std::endl;
+    std::cerr<<"  --persistent          Use one thread team for the whole run, with spin barriers between levels"<<std::endl;
+    std::cerr<<"  --dependency-flowacc  Accumulate flow by counting down each cell's donors rather than by levels"<<std::endl;
+    std::cerr<<"  --pointer-jump-fraction <F>"<<std::endl;
+    std::cerr<<"                        Accumulate flow by pointer jumping when there are more than F*cells levels (default 0.01)"<<std::endl;
+    std::cerr<<"  --newton              Erode with Newton's method even where a closed form exists, and count its iterations"<<std::endl;
+    std::cerr<<"  --warm-start          As above, starting each cell from its change in the previous step"<<std::endl;
+    std::cerr<<"  --renumber            Accumulate flow and erode on copies of the cells' data in stack order"<<std::endl;
+    std::cerr<<"  --neq <N>             Slope exponent of the stream power law (default 2)"<<std::endl;
     return -1;
   }
 
@@ -489,6 +1849,13 @@ int main(int argc, char **argv){
   const std::string output_name =            argv[3] ;
   const auto        rand_seed   = std::stoul(argv[4]);
 
+  //Cells and donor slots are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(8.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
   seed_rand(rand_seed);
 
   //Uses the RichDEM machine-readable line prefixes
@@ -503,6 +1870,60 @@ int main(int argc, char **argv){
 
   CumulativeTimer tmr(true);
   FastScape_RBPF tm(width,height);
+
+  for(int i=5;i<argc;i++){
+    const std::string opt = argv[i];
+    if(opt=="--incremental"){
+      tm.incremental = true;
+    } else if(opt=="--incremental-order"){
+      tm.incremental       = true;
+      tm.incremental_order = true;
+    } else if(opt=="--hybrid"){
+      tm.hybrid = true;
+    } else if(opt=="--persistent"){
+      tm.persistent = true;
+    } else if(opt=="--dependency-flowacc"){
+      tm.dependency_flowacc = true;
+    } else if(opt=="--pointer-jump-fraction" && i+1<argc){
+      tm.pointer_jump_fraction = std::stod(argv[++i]);
+    } else if(opt=="--newton"){
+      tm.newton = true;
+    } else if(opt=="--warm-start"){
+      tm.newton     = true;
+      tm.warm_start = true;
+    } else if(opt=="--renumber"){
+      tm.renumber = true;
+    } else if(opt=="--neq" && i+1<argc){
+      tm.neq = std::stod(argv[++i]);
+    } else {
+      std::cerr<<"Unrecognized option: "<<opt<<std::endl;
+      return -1;
+    }
+  }
+
+  if(tm.hybrid && tm.incremental_order){
+    std::cerr<<"--hybrid cannot be combined with --incremental-order"<<std::endl;
+    return -1;
+  }
+  if(tm.hybrid && tm.dependency_flowacc){
+    std::cerr<<"--hybrid cannot be combined with --dependency-flowacc"<<std::endl;
+    return -1;
+  }
+  if(tm.persistent && (tm.incremental || tm.hybrid || tm.dependency_flowacc)){
+    std::cerr<<"--persistent cannot be combined with other options"<<std::endl;
+    return -1;
+  }
+
+  if(!(tm.neq>0)){
+    std::cerr<<"--neq must be positive"<<std::endl;
+    return -1;
+  }
+
+  if(tm.renumber && (tm.incremental || tm.hybrid || tm.persistent || tm.dependency_flowacc || tm.newton)){
+    std::cerr<<"--renumber cannot be combined with other options"<<std::endl;
+    return -1;
+  }
+
   tm.run(nstep);
   std::cout<<"t Total calculation time    = "<<std::setw(15)<<tmr.elapsed()<<" microseconds"<<std::endl;
 
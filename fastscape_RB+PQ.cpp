@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <fenv.h> //Used to catch floating point NaN issues
 #include <fstream>
@@ -11,6 +13,8 @@
 #include "random.hpp"
 #include <vector>
 #include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ReceiverKernels.hpp"
 
 //Used to handle situations in which OpenMP is not available
 //(This scenario has not been extensively tested)
@@ -64,12 +68,12 @@ class FastScape_RBPQ {
   //results in a significant speed loss. However, it is better to have them here
   //under the assumption that they'd be dynamic in a real implementation.
   const double keq       = 2e-6;   //Stream power equation constant (coefficient)
-  const double neq       = 2;      //Stream power equation constant (slope modifier)
+  double       neq       = 2;      //Stream power equation constant (slope modifier); set with --neq
   const double meq       = 0.8;    //Stream power equation constant (area modifier)
   const double ueq       = 2e-3;   //Rate of uplift
   const double dt        = 1000.;  //Timestep interval
   const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
-  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler
+  const double tol       = 1e-3;   //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
   const double cell_area = 40000;  //Area of a single cell
 
 
@@ -91,14 +95,20 @@ class FastScape_RBPQ {
 
   std::vector<double> h;        //Digital elevation model (height)
   std::vector<double> accum;    //Flow accumulation at each point
+  double              inv_drn[8]; //1/dr^n for each direction, used with PowPositive() for the erosion prefactor
   std::vector<int>    rec;      //Direction of receiving cell
   std::vector<int>    donor;    //Indices of a cell's donor cells
   std::vector<int>    ndon;     //How many donors a cell has
   std::array<int,8>   nshift;   //Offset from a focal cell's index to its neighbours in terms of flat indexing
+  ReceiverKernel      receiver_kernel; //Kernel used to find the receivers of a row of cells
 
   int stack_width;  //Number of cells allowed in the stack
   int level_width;  //Number of cells allowed in a level
 
+  //Used only by the batched Newton solver (see ErodeLevelBatched())
+  double  newton_level_iterations; //Sum over levels of the mean iterations per batch
+  int64_t newton_levels;           //Number of levels solved in batches over the whole run
+
   //Timers for keeping track of how long each part of the code takes
   CumulativeTimer Tmr_Step1_Initialize;
   CumulativeTimer Tmr_Step2_DetermineReceivers;
@@ -147,6 +157,8 @@ class FastScape_RBPQ {
 
     h.resize(size);   //Memory for terrain height
 
+    receiver_kernel = SelectReceiverKernel(); //Fastest kernel this CPU supports
+
     GenerateRandomTerrain();     //Could replace this with custom initializer
 
     Tmr_Step1_Initialize.stop();
@@ -164,26 +176,11 @@ class FastScape_RBPQ {
     //Edge cells do not have receivers because they do not distribute their flow
     //to anywhere.
 
-    #pragma omp for collapse(2)
+    //Each row of interior cells is handed to the receiver kernel chosen when
+    //the model was constructed (see ReceiverKernels.hpp).
+    #pragma omp for
     for(int y=2;y<height-2;y++)
-    for(int x=2;x<width-2;x++){
-      const int c      = y*width+x;
-
-      //The slope must be greater than zero for there to be downhill flow;
-      //otherwise, the cell is marked NO_FLOW.
-      double max_slope = 0;        //Maximum slope seen so far amongst neighbours
-      int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
-
-      //Loop over neighbours
-      for(int n=0;n<8;n++){
-        const double slope = (h[c] - h[c+nshift[n]])/dr[n]; //Slope to neighbour n
-        if(slope>max_slope){    //Is this the steepest slope we've seen?
-          max_slope = slope;    //If so, make a note of the slope
-          max_n     = n;        //And which cell it came from
-        }
-      }
-      rec[c] = max_n;           //Having considered all neighbours, this is the steepest
-    }    
+      receiver_kernel(h.data(), rec.data(), y*width+2, y*width+width-2, nshift, dr);
   }
 
 
@@ -384,30 +381,67 @@ class FastScape_RBPQ {
     for(int li=2;li<nlevel-1;li++){
       const int lvlstart = levels[li];
       const int lvlend   = levels[li+1];
+
+      //Newton's loop keeps the loop below from being vectorized, so exponents
+      //with no closed-form solution are solved in batches instead
+      if(neq!=1 && neq!=2){
+        ErodeLevelBatched(stack, lvlstart, lvlend);
+        continue;
+      }
+
       #pragma omp simd
       for(int si=lvlstart;si<lvlend;si++){
         const int c = stack[si];         //Cell from which flow originates
         const int n = c+nshift[rec[c]];  //Cell receiving the flow
 
-        const double length = dr[rec[c]];
         //`fact` contains a set of values which are constant throughout the integration
-        const double fact   = keq*dt*std::pow(accum[c],meq)/std::pow(length,neq);
+        const double fact   = keq*dt*PowPositive(accum[c],meq)*inv_drn[rec[c]];
         const double h0     = h[c];      //Elevation of focal cell
         const double hn     = h[n];      //Elevation of neighbouring (receiving, lower) cell
-        double hnew         = h0;        //Current updated value of focal cell
-        double hp           = h0;        //Previous updated value of focal cell
-        double diff         = 2*tol;     //Difference between current and previous updated values
-        while(std::abs(diff)>tol){       //Newton-Rhapson method (run until subsequent values differ by less than a tolerance, which can be set to any desired precision)
-          hnew -= (hnew-h0+fact*std::pow(hnew-hn,neq))/(1.+fact*neq*std::pow(hnew-hn,neq-1));
-          diff  = hnew - hp;             //Difference between previous and current value of the iteration
-          hp    = hnew;                  //Update previous value to new value
-        }
-        h[c] = hnew;                     //Update value in array
+        h[c] = ErodeCellImplicit(h0, hn, fact, neq, tol); //Update value in array (see ErosionKernels.hpp)
       }
     }
   }
 
 
+
+  ///Erodes the cells [`lvlstart`,`lvlend`) of `stack`, which must all belong to
+  ///a single level, with ErodeCellsNewton(). Each batch gathers the inputs of
+  ///EROSION_BATCH consecutive cells of the level, the last batch taking
+  ///whatever cells remain, solves them together, and scatters the new
+  ///elevations back.
+  void ErodeLevelBatched(const std::vector<int> &stack, const int lvlstart, const int lvlend){
+    const int nbatches = (lvlend-lvlstart+EROSION_BATCH-1)/EROSION_BATCH;
+    if(nbatches==0)
+      return;
+
+    int64_t iterations = 0;  //Iterations needed by all of the level's batches
+
+    for(int b=0;b<nbatches;b++){
+      const int first  = lvlstart+b*EROSION_BATCH;
+      const int nlanes = std::min(EROSION_BATCH, lvlend-first);
+      double h0[EROSION_BATCH], hn[EROSION_BATCH], fact[EROSION_BATCH], hnew[EROSION_BATCH];
+      for(int l=0;l<nlanes;l++){
+        const int c = stack[first+l];
+        h0  [l] = h[c];
+        hn  [l] = h[c+nshift[rec[c]]];
+        fact[l] = keq*dt*PowPositive(accum[c],meq)*inv_drn[rec[c]];
+      }
+
+      iterations += ErodeCellsNewton(h0, hn, fact, hnew, nlanes, neq, tol);
+
+      for(int l=0;l<nlanes;l++)
+        h[stack[first+l]] = hnew[l];
+    }
+
+    //Every thread erodes its own levels
+    #pragma omp atomic
+    newton_level_iterations += static_cast<double>(iterations)/nbatches;
+    #pragma omp atomic
+    newton_levels++;
+  }
+
+
  public:
 
   ///Run the model forward for a specified number of timesteps. No new
@@ -426,6 +460,19 @@ class FastScape_RBPQ {
     stack_width = std::max(300000,5*size/omp_get_max_threads()); //Number of stack entries available to each thread
     level_width = std::max(1000,size/omp_get_max_threads());     //Number of level entries available to each thread
 
+    newton_level_iterations = 0;
+    newton_levels           = 0;
+
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    //So does the batched Newton solver, for the powers of the drop
+    if(neq!=1 && neq!=2)
+      assert(PowPositiveError(neq)<1e-13 && PowPositiveError(neq-1)<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
     accum.resize(  size);  //Stores flow accumulation
     rec.resize  (  size);  //Array of Receiver directions
     ndon.resize (  size);  //Number of donors each cell has
@@ -478,6 +525,10 @@ class FastScape_RBPQ {
 
     Tmr_Overall.stop();
 
+    std::cout<<"m Receiver kernel = "<<ReceiverKernelName(receiver_kernel)<<std::endl;
+    std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
+    if(newton_levels>0)
+      std::cout<<"m Mean batched Newton iterations per level = "<<(newton_level_iterations/newton_levels)<<std::endl;
     std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
     std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
     std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
@@ -514,8 +565,10 @@ int main(int argc, char **argv){
   //Enable this to stop the program if a floating-point exception happens
   //feenableexcept(FE_ALL_EXCEPT);
 
-  if(argc!=5){
-    std::cerr<<"Syntax: "<<argv[0]<<" <Dimension> <Steps> <Output Name> <Seed>"<<std::endl;
+  if(argc<5){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Dimension> <Steps> <Output Name> <Seed> [Options]"<<std::endl;
+    std::cerr<<"Options:"<<std::endl;
+    std::cerr<<"  --neq <N>             Slope exponent of the stream power law (default 2)"<<std::endl;
     return -1;
   }
 
@@ -525,6 +578,13 @@ int main(int argc, char **argv){
   const std::string output_name =            argv[3] ;
   const auto        rand_seed   = std::stoul(argv[4]);
 
+  //Cells and donor slots are numbered with ints. fastscape_RB+PT switches to
+  //64-bit indices for DEMs too large for that.
+  if(8.0*width*height>std::numeric_limits<int>::max()){
+    std::cerr<<"E DEM too large for 32-bit indices; use fastscape_RB+PT"<<std::endl;
+    return -1;
+  }
+
   seed_rand(rand_seed);
 
   //Uses the RichDEM machine-readable line prefixes
@@ -539,6 +599,22 @@ int main(int argc, char **argv){
 
   CumulativeTimer tmr(true);
   FastScape_RBPQ tm(width,height);
+
+  for(int i=5;i<argc;i++){
+    const std::string opt = argv[i];
+    if(opt=="--neq" && i+1<argc){
+      tm.neq = std::stod(argv[++i]);
+    } else {
+      std::cerr<<"Unrecognized option: "<<opt<<std::endl;
+      return -1;
+    }
+  }
+
+  if(!(tm.neq>0)){
+    std::cerr<<"--neq must be positive"<<std::endl;
+    return -1;
+  }
+
   tm.run(nstep);
   std::cout<<"t Total calculation time    = "<<std::setw(15)<<tmr.elapsed()<<" microseconds"<<std::endl;
 
@@ -0,0 +1,828 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fenv.h> //Used to catch floating point NaN issues
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "random.hpp"
+#include <vector>
+#include "CumulativeTimer.hpp"
+#include "ErosionKernels.hpp"
+#include "ErosionLaws.hpp"
+#include "BoundaryConditions.hpp"
+#include "CellState.hpp"
+#include "GridLayout.hpp"
+#include "ModelParams.hpp"
+#include "ReceiverKernels.hpp"
+
+
+
+///This is a quick-and-dirty, zero-dependency function for saving the outputs of
+///the model in ArcGIS ASCII DEM format (aka Arc/Info ASCII Grid, AAIGrid).
+///Production code for experimentation should probably use GeoTIFF or a similar
+///format as it will have a smaller file size and, thus, save quicker.
+void PrintDEM(
+  const std::string filename, 
+  const std::vector<double>& h,
+  const int width,
+  const int height
+){
+  std::ofstream fout(filename.c_str());
+  //Since the outer ring of the dataset is a halo used for simplifying
+  //neighbour-finding logic, we do not save it to the output here.
+  fout<<"ncols "<<(width- 2)<<"\n";
+  fout<<"nrows "<<(height-2)<<"\n";
+  fout<<"xllcorner 637500.000\n"; //Arbitrarily chosen value
+  fout<<"yllcorner 206000.000\n"; //Arbitrarily chosen value
+  fout<<"cellsize 500.000\n";     //Arbitrarily chosen value
+  fout<<"NODATA_value -9999\n";   //Value which is guaranteed not to correspond to an actual data value
+  for(int y=1;y<height-1;y++){
+    for(int x=1;x<width-1;x++)
+      fout<<h[static_cast<std::size_t>(y)*width+x]<<" ";
+    fout<<"\n";
+  }
+}
+
+
+
+///The entire model is contained in a handy class, which makes it easy to set up
+///and solve many such models.
+///
+///This is RB+P with the storage order of the DEM and the flow graph abstracted
+///into `Layout` (see GridLayout.hpp) and the arrangement of each cell's fields
+///abstracted into `State` (see CellState.hpp). Every stage finds cells and
+///their neighbours through the layout and their fields through the state, so
+///the same model runs on any combination of the two and produces the same
+///heights on each. The state also sets the precision in which heights and flow
+///accumulation are stored; all arithmetic but the summing of flow accumulation
+///is done in double precision regardless.
+///
+///Cells, donor slots, and stack and level entries are all numbered by the
+///layout's `index_t`. The largest number the model forms is a donor slot,
+///8*size, so 32-bit indices serve DEMs of up to about 2^28 cells and 64-bit
+///indices are needed beyond that (see NeedsIndex64()).
+template<class Layout, class State>
+class FastScape_RBPT {
+ private:
+  typedef typename Layout::index_t index_t; //Type of cell, donor, stack, and level indices
+  typedef typename State::elev_t  elev_t;  //Type in which heights are stored
+  typedef typename State::accum_t accum_t; //Type in which flow accumulation is stored and summed
+
+  //Value used to indicate that a cell had no downhill neighbour and, thus, does
+  //not flow anywhere.
+  const int    NO_FLOW = -1;
+  const double SQRT2   = 1.414213562373095048801688724209698078569671875376948; //Yup, this is overkill.
+
+
+ public:
+  //The parameters are set at run time (see ModelParams.hpp). Of these, only the
+  //slope exponent changes the work done per cell, so the erosion loop is
+  //specialized for its common values (see Erode()).
+  const double keq;        //Stream power equation constant (coefficient)
+  const double neq;        //Stream power equation constant (slope modifier)
+  const double meq;        //Stream power equation constant (area modifier)
+  const double ueq;        //Rate of uplift
+  const double dt;         //Timestep interval
+  const double dr[8]     = {1,SQRT2,1,SQRT2,1,SQRT2,1,SQRT2}; //Distance between adjacent cell centers on a rectangular grid arbitrarily scale to cell edge lengths of 1
+  const double tol;        //Tolerance for Newton-Rhapson convergence while solving implicit Euler (only for n other than 1 and 2)
+  const double cell_area;  //Area of a single cell
+  const double threshold;     //Rate of erosion below which no erosion happens (see ThresholdLaw)
+  const double hard_kfactor;  //Factor on keq for hard rock (see LithologyLaw)
+  const double hard_neq;      //Slope exponent for hard rock
+  const BoundaryConditions boundary; //What happens to flow at each edge of the DEM
+
+  bool quiet      = false; //If true, run() prints nothing (used for the double-precision reference of --accuracy)
+  bool specialize = true;  //If false, the slope exponent always takes the generic path (used to measure what the specialization gains)
+  bool newton     = false; //If true, erosion is solved by Newton-Raphson iteration even where the law has a closed form (see NewtonLaw)
+
+
+ private:
+  int width;        //Width of DEM
+  int height;       //Height of DEM
+  index_t size;     //Number of cells in storage (width*height plus any padding the layout needs)
+
+  //The dataset is set up so that the outermost edge is never actually used:
+  //it's a halo which allows every cell that is actually processed to consider
+  //its neighbours in all 8 directions without having to check first to see if
+  //it is an edge cell. The ring of second-most outer cells is set to a fixed
+  //value to which everything erodes (in this model).
+
+  //Rec directions (also used for neighbour offsets) - see below for details
+  //1 2 3
+  //0   4
+  //7 6 5
+
+  State               state;    //Height, flow accumulation, erosion prefactor (see ComputeErosionFactors()), receiver direction, and number of donors of each cell
+  double              inv_drn[8]; //1/dr^n for each direction
+  std::vector<index_t> donor;   //Indices of a cell's donor cells
+  std::vector<index_t> stack;   //Indices of cells in the order they should be processed
+  Layout              layout;   //Maps cells' coordinates and neighbours to flat indices
+  ReceiverKernel      receiver_kernel; //Kernel used to find the receivers of a row of cells
+  std::vector<uint8_t> lithology; //0 for ordinary rock, 1 for hard rock; empty if all rock is ordinary
+  std::string         law_name; //Erosion law used by the last call to Erode(), for logging
+
+  //A level is a set of cells which can all be processed simultaneously.
+  //Topologically, cells within a level are neither descendents or ancestors of
+  //each other in a topological sorting, but are the same number of steps from
+  //the edge of the dataset.
+  std::vector<index_t> levels;  //Indices of locations in stack where a level begins and ends
+  int    nlevel;    //Number of levels used
+
+  index_t stack_width; //Number of cells allowed in the stack
+
+  //Timers for keeping track of how long each part of the code takes
+  CumulativeTimer Tmr_Step1_Initialize;
+  CumulativeTimer Tmr_Step2_DetermineReceivers;
+  CumulativeTimer Tmr_Step3_DetermineDonors;
+  CumulativeTimer Tmr_Step4_GenerateOrder;
+  CumulativeTimer Tmr_Step5_FlowAcc;
+  CumulativeTimer Tmr_Step6_Uplift;
+  CumulativeTimer Tmr_Step7_Erosion;
+  CumulativeTimer Tmr_Overall;
+
+
+ private:
+  void GenerateRandomTerrain(){
+    //srand(std::random_device()());
+    for(int y=0;y<height;y++)
+    for(int x=0;x<width;x++){
+      const index_t c = layout.index(x,y);
+      state.h(c) = static_cast<elev_t>(uniform_rand_real(0,1));
+
+      //Outer edge is set to 0 and never touched again. It is used only as a
+      //convenience so we don't have to worry when a focal cell looks at its
+      //neighbours.
+      if(x == 0 || y==0 || x==width-1 || y==height-1)
+        state.h(c) = 0;
+
+      //Second outer-most edge is set to 0 and never touched again. This is the
+      //baseline to which all cells would erode where it not for uplift. You can
+      //think of this as being "sea level".
+      if(x == 1 || y==1 || x==width-2 || y==height-2)
+        state.h(c) = 0;
+    }
+  }  
+
+
+ public:
+  ///Initializing code
+  FastScape_RBPT(const int width0, const int height0, const ModelParams &params)
+    : keq(params.keq), neq(params.neq), meq(params.meq), ueq(params.ueq),
+      dt(params.dt), tol(params.tol), cell_area(params.cell_area),
+      threshold(params.threshold), hard_kfactor(params.hard_kfactor), hard_neq(params.hard_neq),
+      boundary(params.boundary),
+      //Initialize code for finding neighbours of a cell
+      layout(width0,height0)
+  {
+    Tmr_Overall.start();
+    Tmr_Step1_Initialize.start();
+    width  = width0;
+    height = height0;
+    size   = layout.size();
+
+    state.AllocateHeights(size); //Memory for terrain height (padding cells stay at 0)
+
+    receiver_kernel = SelectReceiverKernel(); //Fastest kernel this CPU supports
+
+    if(boundary.periodic())      //Let the east and west edges drain to each other
+      layout.SetWrap(BoundaryConditions::WrapWest(), BoundaryConditions::WrapEast(width));
+
+    GenerateRandomTerrain();     //Could replace this with custom initializer
+
+    //Hard rock occupies the east of the DEM. Could replace this with a
+    //geological map.
+    if(params.hard_fraction>0){
+      lithology.assign(size, 0);
+      const int hard_start = static_cast<int>(width*(1-params.hard_fraction));
+      for(int y=0;y<height;y++)
+      for(int x=hard_start;x<width;x++)
+        lithology[layout.index(x,y)] = 1;
+    }
+
+    Tmr_Step1_Initialize.stop();
+    Tmr_Overall.stop();
+  }
+
+
+
+ private:
+  ///The receiver of a focal cell is the cell which receives the focal cells'
+  ///flow. Here, we model the receiving cell as being the one connected to the
+  ///focal cell by the steppest gradient. If there is no local gradient, than
+  ///the special value NO_FLOW is assigned.
+  void ComputeReceivers(){
+    //Edge cells do not have receivers because they do not distribute their flow
+    //to anywhere. The boundary conditions are applied to the ring around the
+    //cells which do, so finding receivers is the same whatever they are.
+    boundary.Refresh(layout, state, width, height);
+    ComputeReceivers(std::integral_constant<bool,State::CONTIGUOUS>());
+    boundary.WrapReceivers(layout, state, width, height);
+    boundary.Restore(layout, state, width, height);
+  }
+
+
+
+  ///Each run of interior cells is handed to the receiver kernel chosen when
+  ///the model was constructed (see ReceiverKernels.hpp). The kernels take int
+  ///indices, so the arrays are offset to the start of the run, which is short.
+  void ComputeReceivers(std::true_type){
+    layout.ForEachRun(2, width-2, 2, height-2, [&](const index_t cstart, const index_t cend, const std::array<int,8> &shift){
+      receiver_kernel(state.h_data()+cstart, state.rec_data()+cstart, 0, static_cast<int>(cend-cstart), shift, dr);
+    });
+  }
+
+
+
+  ///The kernels need the heights to be contiguous doubles. Otherwise, we do as
+  ///the scalar kernel does through the state's accessors, in double precision.
+  void ComputeReceivers(std::false_type){
+    layout.ForEachRun(2, width-2, 2, height-2, [&](const index_t cstart, const index_t cend, const std::array<int,8> &shift){
+      for(index_t c=cstart;c<cend;c++){
+        double max_slope = 0;        //Maximum slope seen so far amongst neighbours
+        int    max_n     = NO_FLOW;  //Direction of neighbour which had maximum slope to focal cell
+        for(int n=0;n<8;n++){
+          const double slope = (static_cast<double>(state.h(c)) - state.h(c+shift[n]))/dr[n];
+          if(slope>max_slope){
+            max_slope = slope;
+            max_n     = n;
+          }
+        }
+        state.rec(c) = max_n;
+      }
+    });
+  }
+
+
+
+  ///The donors of a focal cell are the neighbours from which it receives flow.
+  ///Here, we identify those neighbours by inverting the Receivers array.
+  void ComputeDonors(){
+    //Initially, we claim that each cell has no donors.
+    for(index_t i=0;i<size;i++)
+      state.ndon(i) = 0;
+
+    //Looping across all cells
+    for(index_t c=0;c<size;c++){
+      if(state.rec(c)==NO_FLOW)
+        continue;
+      //If this cell passes flow to a downhill cell, make a note of it in that
+      //downhill cell's donor array and increment its donor counter
+      const auto n              = layout.neighbour(c,state.rec(c));
+      donor[8*n+state.ndon(n)] = c;
+      state.ndon(n)++;
+    }
+  }
+
+
+
+  ///Cells must be ordered so that they can be traversed such that higher cells
+  ///are processed before their lower neighbouring cells. This method creates
+  ///such an order. It also produces a list of "levels": cells which are,
+  ///topologically, neither higher nor lower than each other. Cells in the same
+  ///level can all be processed simultaneously without having to worry about
+  ///race conditions.
+  void GenerateOrder(){
+    index_t nstack = 0; //Number of cells currently in the stack
+
+    //Since each value of the `levels` array is later used as the starting value
+    //of a for-loop, we include a zero at the beginning of the array.
+    levels[0] = 0;
+    nlevel    = 1;     //Note that array now contains a single value
+
+    //Load cells without dependencies into the queue. This will include all of
+    //the edge cells and any padding cells of the layout. In a closed domain
+    //every cell may end up here.
+    for(index_t c=0;c<size;c++){
+      if(state.rec(c)==NO_FLOW){
+        stack[nstack++] = c;
+        assert(nstack<=stack_width);
+      }
+    }
+    levels[nlevel++] = nstack; //Last cell of this level
+    assert(nlevel<=static_cast<int>(levels.size()));
+
+    //Start with level_bottom=-1 so we get into the loop, it is immediately
+    //replaced by level_top.
+    index_t level_bottom = -1;     //First cell of the current level
+    index_t level_top    =  0;     //Last cell of the current level
+
+    while(level_bottom<level_top){ //Enusre we parse all the cells
+      level_bottom = level_top;    //The top of the previous level we considered is the bottom of the current level
+      level_top    = nstack;       //The new top is the end of the stack (last cell added from the previous level)
+      for(index_t si=level_bottom;si<level_top;si++){
+        const auto c = stack[si];
+        //Load donating neighbours of focal cell into the stack
+        for(int k=0;k<state.ndon(c);k++){
+          const auto n = donor[8*c+k];
+          stack[nstack++] = n;
+          assert(nstack<=stack_width);
+        }
+      }
+
+      levels[nlevel++] = nstack; //Start a new level
+      assert(nlevel<=static_cast<int>(levels.size()));
+    }
+
+    //End condition for the loop places two identical entries
+    //at the end of the stack. Remove one.
+    nlevel--;
+
+    assert(levels[nlevel-1]==nstack);
+  }
+
+
+
+  ///Compute the flow accumulation for each cell: the number of cells whose flow
+  ///ultimately passes through the focal cell multiplied by the area of each
+  ///cell. Each cell could also have its own weighting based on, say, average
+  ///rainfall.
+  void ComputeFlowAcc(){
+    //Initialize cell areas to their weights. Here, all the weights are the
+    //same.
+    for(index_t i=0;i<size;i++)
+      state.accum(i) = static_cast<accum_t>(cell_area);
+
+    //Highly-elevated cells pass their flow to less elevated neighbour cells.
+    //The queue is ordered so that higher cells are keyed to higher indices in
+    //the queue; therefore, parsing the queue in reverse ensures that fluid
+    //flows downhill.
+    for(index_t s=size-1;s>=0;s--){
+      const index_t c = stack[s];
+      if(state.rec(c)!=NO_FLOW){
+        const index_t n = layout.neighbour(c,state.rec(c));
+        state.accum(n) += state.accum(c);
+      }
+    }    
+  }
+
+
+
+  ///Raise each cell in the landscape by some amount, otherwise it wil get worn
+  ///flat (in this model, with these settings)
+  void AddUplift(){
+    //We exclude two exterior rings of cells in this example. The outermost ring
+    //(the edges of the dataset) allows us to ignore the edges of the dataset,
+    //the second-most outer ring (the cells bordering the edge cells of the
+    //dataset) are fixed to a specified height in this model. All other cells
+    //have heights which actively change and they are altered here.
+    layout.ForEachRun(2, width-2, 2, height-2, [&](const index_t cstart, const index_t cend, const std::array<int,8> &){
+      for(index_t c=cstart;c<cend;c++)
+        state.h(c) = static_cast<elev_t>(state.h(c)+ueq*dt);
+    });
+  }
+
+
+
+  ///Fills `efact` with the prefactor K*dt*A^m/L^n of the implicit erosion
+  ///equation of every cell (see ErosionKernels.hpp). It depends only on the
+  ///flow accumulation and the receivers, so rather than being found cell by
+  ///cell during erosion it is computed for the whole DEM in one pass, which
+  ///vectorizes because PowPositive() stands in for std::pow and `inv_drn` for
+  ///the division. The value for a cell without a receiver is never used.
+  ///
+  ///PowPositive() costs the same for every m, so unlike n, m is not
+  ///specialized: a cheaper kernel for a particular m, such as std::sqrt for
+  ///m=0.5, would differ from it in the last place, which the model amplifies.
+  void ComputeErosionFactors(){
+    const double kdt = keq*dt;
+    #pragma omp parallel for simd
+    for(index_t c=0;c<size;c++)
+      state.efact(c) = static_cast<elev_t>(kdt*PowPositive(state.accum(c),meq)*inv_drn[state.rec(c)&7]);
+  }
+
+
+
+  ///Decrease he height of cells according to the stream power equation; that
+  ///is, based on a constant K, flow accumulation A, the local slope between
+  ///the cell and its receiving neighbour, and some judiciously-chosen constants
+  ///m and n.
+  ///    h_next = h_current - K*dt*(A^m)*(Slope)^n
+  ///We solve this equation implicitly to preserve accuracy. The law is chosen
+  ///here, once per pass, and inlined into the loop over cells (see
+  ///ErosionLaws.hpp).
+  void Erode(){
+    ComputeErosionFactors();
+
+    typedef StreamPowerLaw<ErodeCellRuntimeN> RuntimeLaw;
+    if(!lithology.empty()){
+      const LithologyLaw law(lithology.data(), {1,hard_kfactor}, {neq,hard_neq}, dr, neq, tol);
+      if(newton)
+        ErodeWithThreshold(NewtonLaw<LithologyLaw>(law));
+      else
+        ErodeWithThreshold(law);
+    } else if(newton)
+      ErodeWithThreshold(NewtonLaw<RuntimeLaw>(RuntimeLaw(ErodeCellRuntimeN(neq,tol), tol)));
+    else if(specialize && neq==1)
+      ErodeWithThreshold(StreamPowerLaw<ErodeCellFixedN<1>>(ErodeCellFixedN<1>(), tol));
+    else if(specialize && neq==2)
+      ErodeWithThreshold(StreamPowerLaw<ErodeCellFixedN<2>>(ErodeCellFixedN<2>(), tol));
+    else
+      ErodeWithThreshold(RuntimeLaw(ErodeCellRuntimeN(neq,tol), tol));
+  }
+
+
+
+  ///Adds the erosion threshold, if there is one, to `law`
+  template<class Law>
+  void ErodeWithThreshold(const Law law){
+    if(threshold>0)
+      Erode(ThresholdLaw<Law>(law, dt*threshold));
+    else
+      Erode(law);
+  }
+
+
+
+  ///Does the work of Erode() with each cell solved by `law`
+  template<class Law>
+  void Erode(const Law law){
+    law_name = law.name();
+
+    //The cells in each level can be processed in parallel, so we loop over
+    //levels starting from the lower-most (the one closest to the NO_FLOW cells)
+
+    //Level 0 contains all those cells which do not flow anywhere, so we skip it
+    //since their elevations will not be changed via erosion anyway.
+    for(int li=1;li<nlevel-1;li++){
+      const index_t lvlstart = levels[li];      //Starting index of level in stack
+      const index_t lvlend   = levels[li+1];    //Ending index of level in stack
+      const index_t lvlsize  = lvlend-lvlstart; //Number of cells in the level
+
+      //It's only worth parallelizing if there are enough cells in the level.
+      //For small levels it is more efficient to run the code in serial. The if-
+      //clause in the OpenMP directive below can be adjusted to a suitable value
+      //to account for this.
+      #pragma omp parallel for if(lvlsize>500)
+      for(index_t si=lvlstart;si<lvlend;si++){
+        const index_t c = stack[si];     //Cell from which flow originates
+        if(state.rec(c)==NO_FLOW)        //Ignore cells with no receiving neighbour
+          continue;
+        const index_t n = layout.neighbour(c,state.rec(c)); //Cell receiving the flow
+
+        //`fact` contains a set of values which are constant throughout the integration
+        const double fact   = state.efact(c);
+        const double h0     = state.h(c); //Elevation of focal cell
+        const double hn     = state.h(n); //Elevation of neighbouring (receiving, lower) cell
+        state.h(c) = static_cast<elev_t>(ErodeCellByLaw(law, c, state.rec(c)&7, h0, hn, fact)); //Update value in array (&7 unwraps a wrapped direction)
+      }
+    }
+  }
+
+
+ public:
+
+  ///Run the model forward for a specified number of timesteps. No new
+  ///initialization is done. This allows the model to be stopped, the terrain
+  ///altered, and the model continued. For space-efficiency, a number of
+  ///temporary arrays are created each time this is run, so repeatedly running
+  ///this function for the same model will likely not be performant due to
+  ///reallocations. If that is your use case, you'll want to modify your code
+  ///appropriately.
+  void run(const int nstep){
+    Tmr_Overall.start();
+
+    Tmr_Step1_Initialize.start();
+
+    stack_width = size; //Number of stack entries available to each thread
+
+    state.AllocateWorkspace(size); //Flow accumulation, erosion prefactors, receiver directions, and numbers of donors
+    donor.resize(8*size);  //Array listing the donors of each cell (up to 8 for a rectangular grid)
+    stack.resize(stack_width);  //Order in which to process cells
+
+    //For a square DEM with isotropic dispersion there are approximately
+    //sqrt(E/2) levels, but a single river winding through the whole DEM puts
+    //each cell in a level of its own. Every level holds at least one cell, so
+    //there are at most `size` of them; the first and last entries bound them.
+    levels.resize(size+2);
+
+    ///All receivers initially point to nowhere
+    #pragma omp parallel for
+    for(index_t i=0;i<size;i++)
+      state.rec(i) = NO_FLOW;
+
+    //The erosion prefactors use PowPositive() rather than std::pow, so check
+    //that it is accurate for this exponent
+    const double pow_error = PowPositiveError(meq);
+    assert(pow_error<1e-13);
+    for(int k=0;k<8;k++)
+      inv_drn[k] = 1/std::pow(dr[k],neq);
+
+    Tmr_Step1_Initialize.stop();
+
+    for(int step=0;step<=nstep;step++){
+      Tmr_Step2_DetermineReceivers.start ();   ComputeReceivers  (); Tmr_Step2_DetermineReceivers.stop ();
+      Tmr_Step3_DetermineDonors.start    ();   ComputeDonors     (); Tmr_Step3_DetermineDonors.stop    ();
+      Tmr_Step4_GenerateOrder.start      ();   GenerateOrder     (); Tmr_Step4_GenerateOrder.stop      ();
+      Tmr_Step5_FlowAcc.start            ();   ComputeFlowAcc    (); Tmr_Step5_FlowAcc.stop            ();
+      Tmr_Step6_Uplift.start             ();   AddUplift         (); Tmr_Step6_Uplift.stop             ();
+      Tmr_Step7_Erosion.start            ();   Erode             (); Tmr_Step7_Erosion.stop            ();
+
+      if( step%20==0 && !quiet ) //Show progress
+        std::cout<<"p Step = "<<step<<std::endl;
+    }
+
+    Tmr_Overall.stop();
+
+    if(!quiet){
+      std::cout<<"m Grid layout = "<<layout.name()<<std::endl;
+      std::cout<<"m Index type = "<<(sizeof(index_t)==8 ? "int64" : "int32")<<std::endl;
+      std::cout<<"m Cell state = "<<state.name()<<std::endl;
+      std::cout<<"m Precision = elevation "<<PrecisionName<elev_t>()<<", accumulation "<<PrecisionName<accum_t>()<<std::endl;
+      std::cout<<"m Receiver kernel = "<<(State::CONTIGUOUS ? ReceiverKernelName(receiver_kernel) : std::string("scalar"))<<std::endl;
+      std::cout<<"m PowPositive relative error = "<<pow_error<<std::endl;
+      std::cout<<"m Exponent kernels = "<<ExponentKernelsName()<<std::endl;
+      std::cout<<"m Erosion law = "<<law_name<<std::endl;
+      std::cout<<"t Step1: Initialize         = "<<std::setw(15)<<Tmr_Step1_Initialize.elapsed()         <<" microseconds"<<std::endl;                 
+      std::cout<<"t Step2: DetermineReceivers = "<<std::setw(15)<<Tmr_Step2_DetermineReceivers.elapsed() <<" microseconds"<<std::endl;                         
+      std::cout<<"t Step3: DetermineDonors    = "<<std::setw(15)<<Tmr_Step3_DetermineDonors.elapsed()    <<" microseconds"<<std::endl;                      
+      std::cout<<"t Step4: GenerateOrder      = "<<std::setw(15)<<Tmr_Step4_GenerateOrder.elapsed()      <<" microseconds"<<std::endl;                    
+      std::cout<<"t Step5: FlowAcc            = "<<std::setw(15)<<Tmr_Step5_FlowAcc.elapsed()            <<" microseconds"<<std::endl;              
+      std::cout<<"t Step6: Uplift             = "<<std::setw(15)<<Tmr_Step6_Uplift.elapsed()             <<" microseconds"<<std::endl;             
+      std::cout<<"t Step7: Erosion            = "<<std::setw(15)<<Tmr_Step7_Erosion.elapsed()            <<" microseconds"<<std::endl;              
+      std::cout<<"t Overall                   = "<<std::setw(15)<<Tmr_Overall.elapsed()                  <<" microseconds"<<std::endl;        
+    }
+
+    //Free up memory, except for the resulting landscape height field prior to
+    //exiting so that unnecessary space is not used when the model is not being
+    //run.
+    state.FreeWorkspace();
+    stack .clear();   stack .shrink_to_fit();
+    donor .clear();   donor .shrink_to_fit();
+    levels.clear();   levels.shrink_to_fit();
+  }
+
+
+
+  ///Describes which loop Erode() uses, for logging
+  std::string ExponentKernelsName() const {
+    const bool fixed_n = specialize && !newton && (neq==1 || neq==2) && lithology.empty();
+    return std::string("n ")+(fixed_n ? "fixed" : "runtime");
+  }
+
+
+
+  ///Moves the terrain `columns` cells east, wrapping around within the eroding
+  ///columns (the ring and the halo stay where they are). With periodic east
+  ///and west edges the model has no preferred column, so its output should move
+  ///in the same way; check_periodic.sh relies on this. Hard rock stays where it
+  ///is.
+  void RollTerrain(const int columns){
+    const int ncols = width-4; //Number of eroding columns
+    std::vector<elev_t> row(ncols);
+    for(int y=2;y<height-2;y++){
+      for(int x=0;x<ncols;x++)
+        row[((x+columns)%ncols+ncols)%ncols] = state.h(layout.index(x+2,y));
+      for(int x=0;x<ncols;x++)
+        state.h(layout.index(x+2,y)) = row[x];
+    }
+  }
+
+
+
+  ///Returns a row-major copy of the heights so that they can be printed, &c.
+  std::vector<double> getH() const {
+    std::vector<double> out(static_cast<std::size_t>(width)*height);
+    for(int y=0;y<height;y++)
+    for(int x=0;x<width;x++)
+      out[static_cast<std::size_t>(y)*width+x] = state.h(layout.index(x,y));
+    return out;
+  }
+};
+
+
+
+
+
+
+
+///Builds and runs the model with the given layout and cell state, then saves its
+///output. Returns the resulting heights.
+template<class Layout, class State>
+std::vector<double> RunModel(const ModelParams &params, const bool specialize, const bool newton, const int roll, const int width, const int height, const int nstep, const std::string &output_name){
+  CumulativeTimer tmr(true);
+  FastScape_RBPT<Layout,State> tm(width,height,params);
+  tm.specialize = specialize;
+  tm.newton     = newton;
+  tm.RollTerrain(roll);
+  tm.run(nstep);
+  std::cout<<"t Total calculation time    = "<<std::setw(15)<<tmr.elapsed()<<" microseconds"<<std::endl;
+
+  const std::vector<double> h = tm.getH();
+  PrintDEM(output_name, h, width, height);
+  return h;
+}
+
+
+
+///Chooses the storage precision of the cell state for RunModel(): "float"
+///stores heights and flow accumulation as floats, "mixed" stores heights as
+///floats and flow accumulation as doubles, and anything else stores both as
+///doubles
+template<class Layout, template<class,class> class State>
+std::vector<double> RunModelWithPrecision(const std::string &precision, const ModelParams &params, const bool specialize, const bool newton, const int roll, const int width, const int height, const int nstep, const std::string &output_name){
+  if(precision=="float")
+    return RunModel<Layout,State<float, float >>(params, specialize, newton, roll, width, height, nstep, output_name);
+  else if(precision=="mixed")
+    return RunModel<Layout,State<float, double>>(params, specialize, newton, roll, width, height, nstep, output_name);
+  else
+    return RunModel<Layout,State<double,double>>(params, specialize, newton, roll, width, height, nstep, output_name);
+}
+
+
+
+///Chooses the cell state for RunModelWithPrecision()
+template<class Layout>
+std::vector<double> RunModelWithState(const std::string &state, const std::string &precision, const ModelParams &params, const bool specialize, const bool newton, const int roll, const int width, const int height, const int nstep, const std::string &output_name){
+  if(state=="aos")
+    return RunModelWithPrecision<Layout,AoSState  >(precision, params, specialize, newton, roll, width, height, nstep, output_name);
+  else if(state=="aosoa")
+    return RunModelWithPrecision<Layout,AoSoAState>(precision, params, specialize, newton, roll, width, height, nstep, output_name);
+  else
+    return RunModelWithPrecision<Layout,SoAState  >(precision, params, specialize, newton, roll, width, height, nstep, output_name);
+}
+
+
+
+///Reruns the model from the same seed in double precision, with the layouts the
+///other variants use and so with the output compare.sh checks them against, and
+///reports how far the heights `h` are from it. Only the cells which are saved
+///by PrintDEM() are compared. The reference uses the same index type as the
+///run being checked.
+template<class index_t>
+void ReportAccuracy(const std::vector<double> &h, const ModelParams &params, const int roll, const int width, const int height, const int nstep, const unsigned long rand_seed){
+  seed_rand(rand_seed);
+  FastScape_RBPT<RowMajorLayout<index_t>,SoAState<>> ref(width,height,params);
+  ref.quiet = true;
+  ref.RollTerrain(roll);
+  ref.run(nstep);
+  const std::vector<double> href = ref.getH();
+
+  double max_diff = 0; //Largest absolute difference from the reference
+  double sum_diff = 0; //Sum of absolute differences
+  double sum_sq   = 0; //Sum of squared differences
+  double max_ref  = 0; //Largest reference height
+  for(int y=1;y<height-1;y++)
+  for(int x=1;x<width-1;x++){
+    const std::size_t c = static_cast<std::size_t>(y)*width+x;
+    const double diff = std::abs(h[c]-href[c]);
+    max_diff  = std::max(max_diff,diff);
+    sum_diff += diff;
+    sum_sq   += diff*diff;
+    max_ref   = std::max(max_ref,std::abs(href[c]));
+  }
+  const double ncells = static_cast<double>(width-2)*(height-2);
+
+  //Rounding which changes a cell's receiver reroutes the flow above it, so a
+  //few cells may differ by much more than the rest. Count them.
+  const double threshold = 1e-4*max_ref;
+  long nfar = 0;
+  for(int y=1;y<height-1;y++)
+  for(int x=1;x<width-1;x++){
+    const std::size_t c = static_cast<std::size_t>(y)*width+x;
+    nfar += std::abs(h[c]-href[c])>threshold;
+  }
+
+  std::cout<<"m Accuracy: max |h-h_f64|      = "<<max_diff                        <<std::endl;
+  std::cout<<"m Accuracy: mean |h-h_f64|     = "<<sum_diff/ncells                 <<std::endl;
+  std::cout<<"m Accuracy: RMS h-h_f64        = "<<std::sqrt(sum_sq/ncells)        <<std::endl;
+  std::cout<<"m Accuracy: max |h-h_f64|/max h = "<<(max_ref>0 ? max_diff/max_ref : 0)<<std::endl;
+  std::cout<<"m Accuracy: cells off by >1e-4*max h = "<<nfar<<" ("<<nfar/ncells<<" of all)"<<std::endl;
+}
+
+
+
+///True if the model cannot number the donor slots of a DEM of this size with
+///32-bit indices when it is stored in the given layout
+template<template<class> class Layout>
+bool NeedsIndex64(const int width, const int height){
+  return 8*Layout<std::int64_t>(width,height).size() > std::numeric_limits<int>::max();
+}
+
+
+
+///Chooses the index type of the layout: 32-bit where it suffices, since the
+///donor, stack, and level arrays are then half the size, and 64-bit otherwise
+///or if `index64` is set. Runs the model and, if `accuracy` is set, reports how
+///far it is from a double-precision run.
+template<template<class> class Layout>
+void RunModelWithLayout(const bool index64, const bool accuracy, const std::string &state, const std::string &precision, const ModelParams &params, const bool specialize, const bool newton, const int roll, const int width, const int height, const int nstep, const std::string &output_name, const unsigned long rand_seed){
+  if(index64 || NeedsIndex64<Layout>(width,height)){
+    const std::vector<double> h = RunModelWithState<Layout<std::int64_t>>(state, precision, params, specialize, newton, roll, width, height, nstep, output_name);
+    if(accuracy)
+      ReportAccuracy<std::int64_t>(h, params, roll, width, height, nstep, rand_seed);
+  } else {
+    const std::vector<double> h = RunModelWithState<Layout<int>>(state, precision, params, specialize, newton, roll, width, height, nstep, output_name);
+    if(accuracy)
+      ReportAccuracy<int>(h, params, roll, width, height, nstep, rand_seed);
+  }
+}
+
+
+
+int main(int argc, char **argv){
+  //Enable this to stop the program if a floating-point exception happens
+  //feenableexcept(FE_ALL_EXCEPT);
+
+  if(argc<5){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Dimension> <Steps> <Output Name> <Seed> [Options]"<<std::endl;
+    std::cerr<<"Options:"<<std::endl;
+    std::cerr<<"  --row-major           Store the grid row by row rather than in tiles"<<std::endl;
+    std::cerr<<"  --aos                 Pack each cell's fields into one record"<<std::endl;
+    std::cerr<<"  --aosoa               Pack the fields of blocks of 8 cells into one record"<<std::endl;
+    std::cerr<<"  --float               Store heights and flow accumulation as floats"<<std::endl;
+    std::cerr<<"  --mixed               Store heights as floats and flow accumulation as doubles"<<std::endl;
+    std::cerr<<"  --accuracy            Compare the result with a double-precision run from the same seed"<<std::endl;
+    std::cerr<<"  --index64             Use 64-bit indices even if 32-bit ones suffice"<<std::endl;
+    std::cerr<<"  --params <File>       Read model parameters from a file of 'name = value' lines"<<std::endl;
+    std::cerr<<"  --<name> <Value>      Set model parameter <name>: keq, neq, meq, ueq, dt, tol, cell_area,"<<std::endl;
+    std::cerr<<"                        threshold, hard_fraction, hard_kfactor, hard_neq, boundary"<<std::endl;
+    std::cerr<<"                        boundary is four letters for the N, E, S, W edges: O open,"<<std::endl;
+    std::cerr<<"                        N no-flux, P periodic (E and W only), e.g. --boundary OPNP"<<std::endl;
+    std::cerr<<"  --generic-exponents   Do not use the kernels specialized for common slope exponents"<<std::endl;
+    std::cerr<<"  --newton              Erode by Newton-Raphson iteration even where the law has a closed form"<<std::endl;
+    std::cerr<<"  --roll <Columns>      Move the initial terrain east by <Columns> cells, wrapping around"<<std::endl;
+    std::cerr<<"Parameters are applied in order, so later options override earlier ones."<<std::endl;
+    return -1;
+  }
+
+  const int         width       = std::stoi (argv[1]);
+  const int         height      = std::stoi (argv[1]);
+  const int         nstep       = std::stoi (argv[2]);
+  const std::string output_name =            argv[3] ;
+  const auto        rand_seed   = std::stoul(argv[4]);
+
+  seed_rand(rand_seed);
+
+  //Uses the RichDEM machine-readable line prefixes
+  //Name of algorithm
+  std::cout<<"A FastScape RB+PT"<<std::endl;                
+  //Citation for algorithm
+  std::cout<<"C Richard Barnes TODO"<<std::endl;
+  //Git hash of code used to produce outputs of algorithm
+  std::cout<<"h git_hash    = "<<GIT_HASH<<std::endl;
+  //Random seed used to produce outputs
+  std::cout<<"m Random seed = "<<rand_seed<<std::endl;
+
+  bool        row_major = false;
+  std::string state     = "soa";
+  std::string precision = "double";
+  bool        accuracy  = false;
+  bool        index64   = false;
+  ModelParams params;
+  bool        specialize = true;
+  bool        newton     = false;
+  int         roll       = 0;
+  for(int i=5;i<argc;i++){
+    const std::string opt = argv[i];
+    if(opt=="--row-major"){
+      row_major = true;
+    } else if(opt=="--aos"){
+      state = "aos";
+    } else if(opt=="--aosoa"){
+      state = "aosoa";
+    } else if(opt=="--float"){
+      precision = "float";
+    } else if(opt=="--mixed"){
+      precision = "mixed";
+    } else if(opt=="--accuracy"){
+      accuracy = true;
+    } else if(opt=="--index64"){
+      index64 = true;
+    } else if(opt=="--generic-exponents"){
+      specialize = false;
+    } else if(opt=="--newton"){
+      newton = true;
+    } else if(opt=="--roll" && i+1<argc){
+      roll = std::stoi(argv[++i]);
+    } else if(opt=="--params" && i+1<argc){
+      if(!params.load(argv[++i]))
+        return -1;
+    } else if(opt.compare(0,2,"--")==0 && params.has(opt.substr(2)) && i+1<argc){
+      if(!params.set(opt.substr(2), argv[++i])){
+        std::cerr<<"E Invalid value for "<<opt<<": "<<argv[i]<<std::endl;
+        return -1;
+      }
+    } else {
+      std::cerr<<"Unrecognized option: "<<opt<<std::endl;
+      return -1;
+    }
+  }
+
+  if(!params.validate())
+    return -1;
+  params.print();
+
+  if(row_major)
+    RunModelWithLayout<RowMajorLayout>(index64, accuracy, state, precision, params, specialize, newton, roll, width, height, nstep, output_name, rand_seed);
+  else
+    RunModelWithLayout<TiledLayout   >(index64, accuracy, state, precision, params, specialize, newton, roll, width, height, nstep, output_name, rand_seed);
+
+  return 0;
+}
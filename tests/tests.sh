@@ -15,10 +15,12 @@ if [ "$TESTSYSTEM" == "summitdev" ]; then
     progs=( fastscape_RB+GPU.exe )
 
     #Edge length of a dataset. Number of cells is the square of this value.
-    sizes=( 100 200 400 800 1000 1500 2000 2500 3000 3500 4000 4500 5000 5500 6000 6500 7000 7500 8000 8500 9000 9500 10000 10500 11000 11500 12000 12500 13000 13500 14000 14500 15000 15500 16000 16500 17000 17500 18000 18500 19000 19500 20000 ) 
+    #RB+GPU numbers donor slots with ints, so it refuses DEMs larger than
+    #16383^2; z_index_type covers larger ones with RB+PT.
+    sizes=( 100 200 400 800 1000 1500 2000 2500 3000 3500 4000 4500 5000 5500 6000 6500 7000 7500 8000 8500 9000 9500 10000 10500 11000 11500 12000 12500 13000 13500 14000 14500 15000 15500 16000 ) 
 
     #Number of repetitions for each dataset size. Statistical significance!
-    reps=(    1   1   1   1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1     1 )
+    reps=(    1   1   1   1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1    1     1     1     1     1     1     1     1     1     1     1     1     1     1 )
     for prog in "${progs[@]}"; do
     for (( s=0;   s<${#sizes[@]}; s++ )); do
     for (( rep=0; rep<${reps[s]}; rep++ )); do
@@ -98,7 +100,7 @@ fi
 if [ ! -f "z_parallel_improved_$TESTSYSTEM.dat" ]; then
   echo "RUNNING PARALLEL IMPROVED TESTS"
 
-  progs=( fastscape_BW+PI.exe fastscape_RB+PI.exe )
+  progs=( fastscape_BW+PI.exe fastscape_RB+PI.exe fastscape_RB+PC.exe )
 
   #Edge length of a dataset. Number of cells is the square of this value.
   sizes=( 100 700 1000 7000 10000 ) 
@@ -124,6 +126,367 @@ fi
 
 
 
+if [ ! -f "z_flowacc_engines_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING FLOW ACCUMULATION ENGINE TESTS"
+
+  prog=fastscape_RB+PI.exe
+
+  #Flow accumulation engines to compare: level-parallel and dependency-counting
+  engines=( "" "--dependency-flowacc" )
+
+  #Number of threads to use
+  threads=( 1 2 4 8 16 )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 100 700 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 3 3 )
+  for engine in "${engines[@]}"; do
+  for nthreads in "${threads[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $engine"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "m Threads = $nthreads"
+    echo "H host  = $host"
+
+    echo "R OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_flowacc_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $engine"
+    eval "OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_flowacc_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $engine"
+  done
+  done
+  done
+  done > >(tee -i "z_flowacc_engines_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_subtree_flowacc_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING SUBTREE FLOW ACCUMULATION TESTS"
+
+  prog=fastscape_BW+P.exe
+
+  #Flow accumulation engines to compare: the serial sweep down the stack and the
+  #parallel one from subtree sizes
+  engines=( "" "--subtree-flowacc" )
+
+  #Number of threads to use
+  threads=( 1 2 4 8 16 )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 100 700 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 3 3 )
+  for engine in "${engines[@]}"; do
+  for nthreads in "${threads[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $engine"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "m Threads = $nthreads"
+    echo "H host  = $host"
+
+    echo "R OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_subtree_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $engine"
+    eval "OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_subtree_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $engine"
+  done
+  done
+  done
+  done > >(tee -i "z_subtree_flowacc_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_renumber_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING RENUMBERED LAYOUT TESTS"
+
+  prog=fastscape_RB+PI.exe
+
+  #Layouts to compare: cells in DEM order and cells renumbered into stack order
+  layouts=( "" "--renumber" )
+
+  #Number of threads to use
+  threads=( 1 2 4 8 16 )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 100 700 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 3 3 )
+  for layout in "${layouts[@]}"; do
+  for nthreads in "${threads[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $layout"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "m Threads = $nthreads"
+    echo "H host  = $host"
+
+    echo "R OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_renumber_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $layout"
+    eval "OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_renumber_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $layout"
+  done
+  done
+  done
+  done > >(tee -i "z_renumber_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_grid_layout_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING GRID LAYOUT TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #Layouts to compare: rows stored one after another and square tiles
+  layouts=( "--row-major" "" )
+
+  #Number of threads to use
+  threads=( 1 2 4 8 16 )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 100 700 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 3 3 )
+  for layout in "${layouts[@]}"; do
+  for nthreads in "${threads[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $layout"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "m Threads = $nthreads"
+    echo "H host  = $host"
+
+    echo "R OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_grid_layout_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $layout"
+    eval "OMP_NUM_THREADS=$nthreads $exe_prefix$prog $size $steps out_grid_layout_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $layout"
+  done
+  done
+  done
+  done > >(tee -i "z_grid_layout_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_cell_state_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING CELL STATE LAYOUT TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #Grid layouts: rows stored one after another and square tiles
+  layouts=( "--row-major" "" )
+
+  #Arrangements of each cell's fields: struct of arrays, array of structs, and
+  #array of structs of arrays
+  states=( "" "--aos" "--aosoa" )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 100 700 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 3 3 )
+  for layout in "${layouts[@]}"; do
+  for state in "${states[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $layout $state"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "H host  = $host"
+
+    echo "R $exe_prefix$prog $size $steps out_cell_state_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $layout $state"
+    eval "$exe_prefix$prog $size $steps out_cell_state_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $layout $state"
+  done
+  done
+  done
+  done > >(tee -i "z_cell_state_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_precision_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING PRECISION TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #Storage precisions: doubles, float heights with double flow accumulation,
+  #and floats. Each run also reports its error against a double-precision run.
+  precisions=( "" "--mixed" "--float" )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 100 700 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 3 3 )
+  for precision in "${precisions[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog --row-major $precision"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "H host  = $host"
+
+    echo "R $exe_prefix$prog $size $steps out_precision_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 --row-major $precision --accuracy"
+    eval "$exe_prefix$prog $size $steps out_precision_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 --row-major $precision --accuracy"
+  done
+  done
+  done > >(tee -i "z_precision_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_index_type_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING INDEX TYPE TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #32-bit indices (the default where they fit) and forced 64-bit indices. The
+  #largest size needs 64-bit indices whatever the option.
+  index_types=( "" "--index64" )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 1000 7000 10000 20000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 1 )
+  for index_type in "${index_types[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $index_type"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "H host  = $host"
+
+    echo "R $exe_prefix$prog $size $steps out_index_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $index_type"
+    eval "$exe_prefix$prog $size $steps out_index_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $index_type"
+  done
+  done
+  done > >(tee -i "z_index_type_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_exponents_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING EXPONENT TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #Slope exponents with specialized kernels, and one without
+  exponents=( "--meq 0.8 --neq 2" "--meq 0.5 --neq 1" "--meq 0.45 --neq 1.5" )
+
+  #Kernels specialized for the slope exponent where available, and the generic ones
+  kernels=( "" "--generic-exponents" )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 )
+  for exponent in "${exponents[@]}"; do
+  for kernel in "${kernels[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $exponent $kernel"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "H host  = $host"
+
+    echo "R $exe_prefix$prog $size $steps out_exponents_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $exponent $kernel"
+    eval "$exe_prefix$prog $size $steps out_exponents_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $exponent $kernel"
+  done
+  done
+  done
+  done > >(tee -i "z_exponents_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_erosion_law_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING EROSION LAW TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #The built-in stream power law, with an erosion threshold, with hard rock in
+  #the east half of the DEM, and with both. The last solves the built-in law by
+  #Newton-Raphson iteration rather than in closed form.
+  laws=( "" "--threshold 1e-4" "--hard_fraction 0.5" "--hard_fraction 0.5 --threshold 1e-4" "--newton" )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 )
+  for law in "${laws[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog $law"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "H host  = $host"
+
+    echo "R $exe_prefix$prog $size $steps out_law_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $law"
+    eval "$exe_prefix$prog $size $steps out_law_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 $law"
+  done
+  done
+  done > >(tee -i "z_erosion_law_$TESTSYSTEM.dat")
+fi
+
+
+
+if [ ! -f "z_boundary_$TESTSYSTEM.dat" ]; then
+  echo "RUNNING BOUNDARY CONDITION TESTS"
+
+  prog=fastscape_RB+PT.exe
+
+  #Edges N, E, S, W: all open, east-west periodic, periodic with a no-flux
+  #south edge, and all but the north no-flux
+  boundaries=( "OOOO" "OPOP" "OPNP" "ONNN" )
+
+  #Edge length of a dataset. Number of cells is the square of this value.
+  sizes=( 1000 7000 10000 ) 
+
+  #Number of repetitions for each dataset size. Statistical significance!
+  reps=( 3 3 3 )
+  for boundary in "${boundaries[@]}"; do
+  for (( s=0;   s<${#sizes[@]}; s++ )); do
+  for (( rep=0; rep<${reps[s]}; rep++ )); do
+    size=${sizes[s]}
+    echo "# Prog  = $prog --boundary $boundary"
+    echo "m Size  = $size"
+    echo "m Steps = $steps"
+    echo "m Rep   = $rep"
+    echo "H host  = $host"
+
+    echo "R $exe_prefix$prog $size $steps out_boundary_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 --boundary $boundary"
+    eval "$exe_prefix$prog $size $steps out_boundary_${prog}_${size}_${steps}_${rep}_${TESTSYSTEM}.dem 123 --boundary $boundary"
+  done
+  done
+  done > >(tee -i "z_boundary_$TESTSYSTEM.dat")
+fi
+
+
+
 if [ ! -f "z_serial_comparison_$TESTSYSTEM.dat" ]; then
   echo "RUNNING SERIAL TESTS"
 